@@ -1,24 +1,32 @@
 
 #include <map>
 #include <list>
+#include <vector>
 #include <string>
+#include <atomic>
+#include <cmath>
 #include <cstring>
 #include <cassert>
 #include <cstdlib>
-#include <cmath>
-
-#include <sndfile.h>
 
 #include <pulse/pulseaudio.h>
-#include <pulse/glib-mainloop.h>
 
 #include <glib.h>
 
 #include "soundrec.hpp"
+#include "soundrec_clip.hpp"
+#include "soundrec_pool.hpp"
+#include "soundrec_ring.hpp"
+#include "soundrec_align.hpp"
+#include "soundrec_mix.hpp"
+#include "soundrec_trigger.hpp"
+#include "soundrec_wav.hpp"
+#include "soundrec_rotate.hpp"
+#include "soundrec_save.hpp"
 
 extern "C" {
-	/* The sample format to use */
-	static const pa_sample_spec ss = {
+	/* The sample format to use unless recording in the native format */
+	static pa_sample_spec ss = {
 		.format = PA_SAMPLE_S16LE,
 		.rate = 44100,
 		.channels = 2
@@ -27,49 +35,65 @@ extern "C" {
 
 using namespace std;
 
-#define BLOCK_SIZE (1024*1024)
-
-class Clip {
-	private:
-		list<char *>::iterator it;
-		static size_t num_clips;
-	public: 
-		list<char *> blocks;
-		char *buf;
-		size_t capacity;
-		size_t rec_size;
-		size_t played_size;
-		size_t id;
-		static map<size_t,Clip*> clip_map;
-		Clip() : capacity(0), rec_size(0), played_size(0) {
-			this->expand();
-			id = num_clips++;
-			clip_map[id] = this;
-		}
-		char* expand() {
-			blocks.push_back((char *)malloc(BLOCK_SIZE));
-			capacity += BLOCK_SIZE;
-			return buf = blocks.back();
-		}
-		char* next() {
-			return buf = *(++it);
-		}
-		char* rewind() {
-			it = blocks.begin();
-			return buf = blocks.front();
-		}
-		~Clip() {
-			clip_map.erase(id);
-			it = blocks.begin();
-			while (it != blocks.end()) {
-				free(*it++);
-			}
+/* Seconds of audio the ring between capture and the main loop holds at least */
+#define RING_SECONDS 4
+/* Seconds between looks for clips to compress */
+#define PACK_INTERVAL 5
+/* Seconds of audio the rotating file writer may fall behind by */
+#define ROTATE_BUFFER 30
+
+/*
+ * One capture stream, recording into a clip of its own or, with a group,
+ * as one track of a clip several streams are aligned into.
+ */
+class Session {
+	public:
+		pa_stream *s;
+		Clip *clip;
+		pa_sample_spec spec;
+		Ring *ring;
+		Kernels meter;
+		int silence;
+		atomic<float> level;
+		atomic<size_t> dropped;
+		atomic<bool> drain_pending;
+		size_t lost;
+		bool stopped;
+		Aligner *group;
+		unsigned track;
+		/* Bytes delivered so far, counted on the PulseAudio thread */
+		uint64_t captured;
+		/* Latest capture timestamp, published under a sequence count */
+		atomic<unsigned> mark_seq;
+		atomic<uint64_t> mark_frame;
+		atomic<uint64_t> mark_usec;
+		/*
+		 * Standing by: no clip until the level triggers one, or until Record
+		 * without a trigger, and the clip begins with what came before
+		 */
+		Trigger *trigger;
+		History *history;
+		/* Bytes of quiet in the triggered clip so far, and how many close it */
+		size_t quiet;
+		size_t hold;
+		/* A frame split between drains while standing by */
+		vector<char> part;
+		/* Capturing to a run of files instead of a clip */
+		Rotator *rot;
+		Session(Clip *c, const pa_sample_spec &ss, size_t ring_size) : s(NULL), clip(c),
+				spec(ss), ring(new Ring(ring_size, pa_frame_size(&ss), (ss.format == PA_SAMPLE_U8) ? 0x80 : 0)),
+				meter(dsp_kernels(&ss)), silence((ss.format == PA_SAMPLE_U8) ? 0x80 : 0),
+				level(0.0f), dropped(0), drain_pending(false), lost(0), stopped(false),
+				group(NULL), track(0), captured(0), mark_seq(0), mark_frame(0), mark_usec(0),
+				trigger(NULL), history(NULL), quiet(0), hold(0), rot(NULL) {}
+		~Session() {
+			delete ring;
+			delete trigger;
+			delete history;
+			delete rot;
 		}
 };
 
-map<size_t,Clip*> Clip::clip_map;
-size_t Clip::num_clips = 0;
-
 namespace soundrec {
 	const char *monitor, *mic;
 	list<Device*> sinks;
@@ -84,8 +108,38 @@ namespace soundrec {
 	void (*user_inputs_cb)(list<Input*>&, map<uint32_t,update_t>&) = NULL;
 	void (*user_sources_cb)(list<Device*>&, list<Device*>&) = NULL;
 	void (*user_pcm_cb)(size_t) = NULL;
+	void (*user_trigger_cb)(size_t) = NULL;
+	void (*user_mix_cb)(size_t) = NULL;
 	
-	Clip *cur;
+	list<Session*> sessions;
+	/* The armed or replay source, never in sessions */
+	Session *standby = NULL;
+	/* The source being captured to files, never in sessions */
+	Session *rotating = NULL;
+	Cursor play(NULL, 0);
+	bool playing = false;
+	clip_store store = STORE_MEMORY;
+	clip_codec codec = CODEC_NONE;
+	bool native = false;
+	latency_profile rec_latency = LATENCY_BALANCED;
+	latency_profile play_latency = LATENCY_BALANCED;
+	bool multitrack = false;
+	unsigned pack_idle = 30;
+	/* Quiet stretches are left out of recordings when trim_level > 0 */
+	float trim_level = 0.0f;
+	double trim_hangover = 2.0;
+	double trim_pad = 0.25;
+	/* RMS level that starts a clip when armed, seconds before it kept, seconds of quiet ending it */
+	float trig_level = 0.01f;
+	double trig_preroll = 2.0;
+	double trig_hold = 5.0;
+	/* Seconds the replay source keeps */
+	double replay_seconds = 10.0;
+	/* Where rotated files go, what they are called and when they are cut */
+	string rotate_dir;
+	string rotate_prefix = "Capture";
+	double rotate_minutes = 60.0;
+	double rotate_mbytes = 0.0;
 	
 	list<Input*> inputs;
 	
@@ -97,11 +151,9 @@ namespace soundrec {
 	map<uint32_t, update_t> update_map_frozen;
 	bool update_pending = false;
 
-	pa_stream *rs = NULL;
 	pa_stream *ps = NULL;
 	pa_context *ctx;
-
-	rec_state state = IDLE;
+	pa_threaded_mainloop *ml;
 }
 
 template <class T>
@@ -115,6 +167,24 @@ void clear_list(list<T> l) {
 
 using namespace soundrec;
 
+/* User callbacks run on the main loop, never on the PulseAudio thread */
+gboolean sources_idle_cb(void *) {
+	pa_threaded_mainloop_lock(ml);
+	user_sources_cb(monitors, mics);
+	pa_threaded_mainloop_unlock(ml);
+	return FALSE;
+}
+
+gboolean inputs_idle_cb(void *) {
+	pa_threaded_mainloop_lock(ml);
+	if (user_inputs_cb != NULL) {
+		user_inputs_cb(inputs, update_map_frozen);
+	}
+	update_pending = false;
+	pa_threaded_mainloop_unlock(ml);
+	return FALSE;
+}
+
 void update_monitors() {
 	list<Device*>::iterator si, so;
 	string *sink, *source;
@@ -142,13 +212,13 @@ void update_monitors() {
 	}
 	assert(got_monitors);
 	if (user_sources_cb != NULL) {
-		user_sources_cb(monitors, mics);
+		g_idle_add(sources_idle_cb, NULL);
 	}
 }
 
 void sink_cb(pa_context *c, const pa_sink_info *l, int eol, void *data) {
 	if (eol == 0) {
-		sinks.push_back(new Device(l->name, l->index));
+		sinks.push_back(new Device(l->name, l->index, l->sample_spec));
 	} else {
 		got_sinks = true;
 		if (got_sources) {
@@ -159,7 +229,7 @@ void sink_cb(pa_context *c, const pa_sink_info *l, int eol, void *data) {
 
 void source_cb(pa_context *c, const pa_source_info *l, int eol, void *data) {
 	if (eol == 0) {
-		sources.push_back(new Device(l->name, l->index));
+		sources.push_back(new Device(l->name, l->index, l->sample_spec));
 	} else {
 		got_sources = true;
 		if (got_sinks) {
@@ -226,7 +296,7 @@ void sink_input_cb(pa_context *c, const pa_sink_input_info *l, int eol, void *da
 	Input *input;
 	if (eol == 0) {
 		if (need_to_update(l->index)) {
-			input = new Input(l->sink, l->index);
+			input = new Input(l->sink, l->index, l->sample_spec);
 			while ((key = pa_proplist_iterate(l->proplist, &iter)) != NULL) {
 				val = pa_proplist_gets(l->proplist, key);
 				input->props[string(key)] = string(val);
@@ -234,10 +304,7 @@ void sink_input_cb(pa_context *c, const pa_sink_input_info *l, int eol, void *da
 			inputs.push_back(input);
 		}
 	} else {
-		if (user_inputs_cb != NULL) {
-			user_inputs_cb(inputs, update_map_frozen);
-		}
-		update_pending = false;
+		g_idle_add(inputs_idle_cb, NULL);
 	}
 }
 
@@ -254,6 +321,7 @@ gboolean update_cb(void *data) {
 	list<Input*>::iterator it;
 	Input *inp;
 	
+	pa_threaded_mainloop_lock(ml);
 	for (it = inputs.begin(); it != inputs.end(); it++) {
 		inp = *it;
 		if (update_map[inp->index] == REMOVE || update_map[inp->index] == CHANGE) {
@@ -264,6 +332,7 @@ gboolean update_cb(void *data) {
 	update_sink_inputs(c);
 	update_map_frozen = update_map;
 	update_map.clear();
+	pa_threaded_mainloop_unlock(ml);
 	return FALSE;
 }
 
@@ -311,251 +380,982 @@ void connect_cb(pa_context *c, void *) {
 	}
 }
 
-void soundrec_stop_playback() {
+/* Called with the mainloop lock held */
+void stop_playback() {
 	pa_stream_disconnect(ps);
 	pa_stream_unref(ps);
-	state = IDLE;
+	playing = false;
 }
 
-void soundrec_stop_recording() {
-	pa_stream_disconnect(rs);
-	pa_stream_unref(rs);
-	state = IDLE;
+void soundrec_stop_playback() {
+	pa_threaded_mainloop_lock(ml);
+	/* write_cb may have finished the clip in the meantime */
+	if (playing) {
+		stop_playback();
+	}
+	pa_threaded_mainloop_unlock(ml);
+}
+
+/* A clip for a new recording, trimmed if asked to */
+static Clip *new_recording(const pa_sample_spec &spec) {
+	Clip *clip = new Clip(store, spec, codec);
+	
+	if (trim_level > 0.0f) {
+		clip->trim = new Trimmer(spec, trim_level, trim_hangover, trim_pad);
+	}
+	return clip;
+}
+
+/* Hands the latest capture timestamp of a track to its aligner */
+static void take_mark(Session *sn) {
+	unsigned seq;
+	uint64_t frame, usec;
+	
+	do {
+		seq = sn->mark_seq.load(memory_order_acquire);
+		frame = sn->mark_frame.load(memory_order_relaxed);
+		usec = sn->mark_usec.load(memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != sn->mark_seq.load(memory_order_relaxed));
+	
+	if (seq > 0) {
+		sn->group->mark(sn->track, frame, usec);
+	}
+}
+
+/* The clip is complete, the source goes back to standing by */
+static void end_standby_clip(Session *sn) {
+	sn->clip->finish();
+	sn->clip = NULL;
+	sn->lost = 0;
+}
+
+/* Starts a clip on a source standing by, beginning with its history */
+static void seed(Session *sn) {
+	size_t n;
+	
+	sn->clip = new_recording(sn->spec);
+	n = sn->history->replay(sn->clip);
+	/* So tracks still line up when mixed */
+	sn->clip->started -= pa_bytes_to_usec(n, &sn->spec);
+	sn->quiet = 0;
+	sn->lost = 0;
+}
+
+/*
+ * Standing by: audio goes into the history until a clip is started, by
+ * the trigger if there is one. A triggered clip ends after hold bytes of
+ * quiet, any other when it is stopped. Takes whole frames only.
+ */
+static void hear(Session *sn, const char *data, size_t n) {
+	bool loud = sn->trigger != NULL && sn->trigger->loud(data, n);
+	
+	if (sn->clip == NULL) {
+		if (!loud) {
+			sn->history->keep(data, n);
+			return;
+		}
+		seed(sn);
+		if (user_trigger_cb != NULL) {
+			user_trigger_cb(sn->clip->id);
+		}
+	}
+	
+	sn->clip->record(data, n);
+	sn->history->pass(n);
+	if (sn->trigger == NULL) {
+		return;
+	}
+	sn->quiet = loud ? 0 : sn->quiet + n;
+	if (sn->quiet >= sn->hold) {
+		end_standby_clip(sn);
+	}
+}
+
+/*
+ * A frame split between drains is put back together before it is heard,
+ * so clips start and end on frame boundaries and the history keeps in step
+ */
+static void listen(Session *sn, const char *data, size_t n) {
+	const size_t frame = sn->meter.frame;
+	size_t m;
+	
+	if (!sn->part.empty()) {
+		m = frame - sn->part.size() < n ? frame - sn->part.size() : n;
+		sn->part.insert(sn->part.end(), data, data + m);
+		data += m;
+		n -= m;
+		if (sn->part.size() < frame) {
+			return;
+		}
+		hear(sn, &sn->part[0], frame);
+		sn->part.clear();
+	}
+	
+	m = n - n%frame;
+	if (m > 0) {
+		hear(sn, data, m);
+	}
+	sn->part.assign(data + m, data + n);
+}
+
+/* Captured audio, or silence standing in for it, to wherever the session sends it */
+static void feed(Session *sn, const char *data, size_t n) {
+	if (sn->group != NULL) {
+		sn->group->feed(sn->track, data, n);
+	} else if (sn->rot != NULL) {
+		sn->rot->write(data, n);
+	} else if (sn->history != NULL) {
+		listen(sn, data, n);
+	} else {
+		sn->clip->record(data, n);
+	}
 }
 
-void read_cb(pa_stream *s, size_t nbytes, void *data) {
-	char *bh;
-	size_t ns;
-	size_t bytes_top;
-	size_t bytes_in_block;
+/* Moves everything captured so far from a session's ring into its clip */
+void drain_ring(Session *sn) {
+	const char *data;
+	size_t n, total = 0, lost;
+	
+	if (sn->group != NULL) {
+		take_mark(sn);
+	}
+	
+	while ((n = sn->ring->peek(&data)) > 0) {
+		feed(sn, data, n);
+		sn->ring->consume(n);
+		total += n;
+	}
+	
+	lost = sn->dropped.exchange(0);
+	if (lost > 0) {
+		sn->lost += lost;
+		fprintf(stderr, __FILE__": capture ring overrun, %zu bytes replaced with silence\n", lost);
+	}
 	
-	pa_stream_peek(s, (const void **)&data, &nbytes);
+	/* Only what every track has caught up to goes into the clip */
+	if (sn->group != NULL) {
+		total = sn->group->mix(sn->clip);
+	}
 	
-	bytes_in_block = cur->rec_size - (BLOCK_SIZE*(cur->rec_size/BLOCK_SIZE));
+	if (total > 0 && user_pcm_cb != NULL) {
+		user_pcm_cb(total);
+	}
+}
 
-	bh = cur->buf + bytes_in_block;
-	bytes_top = BLOCK_SIZE - bytes_in_block;
+/*
+ * The last of a stopped session: what is in its ring, then the silence
+ * still owed for what the ring had no room for
+ */
+static void drain_last(Session *sn) {
+	char buf[4096];
+	const size_t chunk = sizeof(buf) - sizeof(buf)%sn->meter.frame;
+	size_t n;
+	
+	drain_ring(sn);
+	memset(buf, sn->silence, chunk);
+	while (sn->ring->owed > 0) {
+		n = sn->ring->owed < chunk ? sn->ring->owed : chunk;
+		feed(sn, buf, n);
+		sn->ring->owed -= n;
+	}
+}
 
-	ns = cur->rec_size + nbytes;
+gboolean drain_cb(void *data) {
+	Session *sn = (Session *)data;
 	
-	if (nbytes > bytes_top) {
-		memcpy(bh, data, bytes_top);
-		nbytes -= bytes_top;
-		data += bytes_top;
+	sn->drain_pending = false;
+	/* The session was stopped while this was queued and left for us to free */
+	if (sn->stopped) {
+		delete sn;
+	} else {
+		drain_ring(sn);
+	}
+	return FALSE;
+}
 
-		if (ns > cur->capacity) {
-			bh = cur->expand();
+/* Stops every stream recording into the clip and completes it */
+static void stop_clip(size_t id) {
+	list<Session*> done;
+	list<Session*>::iterator it;
+	Aligner *group = NULL;
+	Clip *clip = NULL;
+	size_t n;
+	
+	/* A clip from the armed or replay source ends, the source stays */
+	if (standby != NULL && standby->clip != NULL && standby->clip->id == id) {
+		drain_ring(standby);
+		if (standby->clip != NULL && standby->clip->id == id) {
+			end_standby_clip(standby);
+		}
+		return;
+	}
+	
+	pa_threaded_mainloop_lock(ml);
+	for (it = sessions.begin(); it != sessions.end(); ) {
+		if ((*it)->clip->id == id) {
+			pa_stream_disconnect((*it)->s);
+			pa_stream_unref((*it)->s);
+			done.push_back(*it);
+			it = sessions.erase(it);
 		} else {
-			bh = cur->next();
+			it++;
 		}
 	}
+	pa_threaded_mainloop_unlock(ml);
 	
-	memcpy(bh, data, nbytes);
-	cur->rec_size = ns;
+	for (it = done.begin(); it != done.end(); it++) {
+		drain_last(*it);
+		group = (*it)->group;
+		clip = (*it)->clip;
+	}
 	
-	if (user_pcm_cb != NULL) {
-		user_pcm_cb(nbytes);
+	if (clip == NULL) {
+		return;
 	}
+	/* The silence owed to the tracks went in after their last mix */
+	if (group != NULL && (n = group->mix(clip)) > 0 && user_pcm_cb != NULL) {
+		user_pcm_cb(n);
+	}
+	clip->finish();
+	delete group;
+	
+	/* No read_cb can run any more, so drain_pending won't change */
+	for (it = done.begin(); it != done.end(); it++) {
+		if ((*it)->drain_pending) {
+			(*it)->stopped = true;
+		} else {
+			delete *it;
+		}
+	}
+}
 
-	pa_stream_drop(s);
+/* Sessions are only added and removed on the main loop */
+static Session *find_session(size_t id) {
+	list<Session*>::iterator it;
+	
+	for (it = sessions.begin(); it != sessions.end(); it++) {
+		if ((*it)->clip->id == id) {
+			return *it;
+		}
+	}
+	if (standby != NULL && standby->clip != NULL && standby->clip->id == id) {
+		return standby;
+	}
+	return NULL;
 }
 
-void my_free(void *) {}
+void soundrec_stop_recording() {
+	while (!sessions.empty()) {
+		stop_clip(sessions.front()->clip->id);
+	}
+	if (standby != NULL && standby->clip != NULL) {
+		stop_clip(standby->clip->id);
+	}
+}
 
-void write_cb(pa_stream *s, size_t nbytes, void *data) {
-	char *bh;
-	size_t bytes_left;
-	size_t bytes_top;
-	size_t bytes_in_block;
+void soundrec_stop_recording_clip(size_t id) {
+	stop_clip(id);
+}
+
+/* Dates the fragment about to be read: it was captured latency ago */
+static void put_mark(Session *sn, pa_stream *s) {
+	pa_usec_t lat;
+	int neg;
+	unsigned seq;
 	
-	if (state != PLAYING_BACK) 
+	if (pa_stream_get_latency(s, &lat, &neg) < 0) {
 		return;
+	}
+	if (neg) {
+		lat = 0;
+	}
+	
+	seq = sn->mark_seq.load(memory_order_relaxed);
+	sn->mark_seq.store(seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	sn->mark_frame.store(sn->captured/sn->meter.frame, memory_order_relaxed);
+	sn->mark_usec.store(pa_rtclock_now() - lat, memory_order_relaxed);
+	sn->mark_seq.store(seq+2, memory_order_release);
+}
+
+/*
+ * Runs on the PulseAudio thread: only copies into the session's ring,
+ * which stands silence in for fragments it has no room for
+ */
+void read_cb(pa_stream *s, size_t nbytes, void *userdata) {
+	Session *sn = (Session *)userdata;
+	const void *data;
+	float pk;
+	
+	/* Several fragments may have queued up since the last wakeup */
+	while (pa_stream_readable_size(s) > 0) {
+		if (pa_stream_peek(s, &data, &nbytes) < 0 || nbytes == 0) {
+			break;
+		}
+		
+		if (sn->group != NULL) {
+			put_mark(sn, s);
+		}
+		sn->captured += nbytes;
+		
+		/* A hole in the stream (NULL data) keeps the timeline with silence */
+		if (data != NULL) {
+			pk = sn->meter.peak((const char *)data, nbytes/sn->meter.frame, sn->meter.channels);
+			if (pk > sn->level.load(memory_order_relaxed)) {
+				sn->level.store(pk, memory_order_relaxed);
+			}
+		}
+		if (!sn->ring->put((const char *)data, nbytes)) {
+			sn->dropped += nbytes;
+		}
+		
+		pa_stream_drop(s);
+	}
 	
-	bytes_in_block = cur->played_size - (BLOCK_SIZE*(cur->played_size/BLOCK_SIZE));
+	if (!sn->drain_pending.exchange(true)) {
+		g_idle_add(drain_cb, sn);
+	}
+}
+
+void my_free(void *) {}
 
-	bh = cur->buf + bytes_in_block;
-	bytes_left = cur->rec_size - cur->played_size;
+void write_cb(pa_stream *s, size_t nbytes, void *data) {
+	const char *bh;
+	size_t n;
+	
+	if (!playing) 
+		return;
 	
-	if (nbytes > bytes_left) {
-		nbytes = bytes_left;
-		bytes_left = 0;
+	while (nbytes > 0 && (n = play.next(&bh, nbytes)) > 0) {
+		pa_stream_write(s, bh, n, my_free, 0, PA_SEEK_RELATIVE);
+		nbytes -= n;
 	}
 
-	bytes_top = BLOCK_SIZE - bytes_in_block;
+	if (play.pos == play.clip->rec_size) {
+		stop_playback();
+	}
+}
 
-	if (nbytes > bytes_top) {
-		pa_stream_write(s, bh, bytes_top, my_free, 0, PA_SEEK_RELATIVE);
+/* 
+ * The closest little-endian format a clip can hold and libsndfile can 
+ * write without conversion.
+ */
+static pa_sample_format_t storable(pa_sample_format_t f) {
+	switch (f) {
+		case PA_SAMPLE_U8:
+		case PA_SAMPLE_S16LE:
+		case PA_SAMPLE_S24LE:
+		case PA_SAMPLE_S32LE:
+		case PA_SAMPLE_FLOAT32LE:
+			return f;
+		case PA_SAMPLE_S24BE:
+			return PA_SAMPLE_S24LE;
+		case PA_SAMPLE_S24_32LE:
+		case PA_SAMPLE_S24_32BE:
+		case PA_SAMPLE_S32BE:
+			return PA_SAMPLE_S32LE;
+		case PA_SAMPLE_FLOAT32BE:
+			return PA_SAMPLE_FLOAT32LE;
+		default:
+			return PA_SAMPLE_S16LE;
+	}
+}
 
-		cur->played_size += bytes_top;
-		nbytes -= bytes_top;
+/* Target fragment (record) or buffer (playback) length per profile */
+static const pa_usec_t latency_usec[2][3] = {
+	{ 10*PA_USEC_PER_MSEC, 50*PA_USEC_PER_MSEC, 1000*PA_USEC_PER_MSEC },
+	{ 30*PA_USEC_PER_MSEC, 250*PA_USEC_PER_MSEC, 2000*PA_USEC_PER_MSEC }
+};
 
-		bh = cur->next();
+static pa_buffer_attr buffer_attr(bool record, latency_profile p, const pa_sample_spec *spec) {
+	pa_buffer_attr attr;
+	size_t len = pa_usec_to_bytes(latency_usec[record ? 0 : 1][p], spec);
+	
+	attr.maxlength = (uint32_t)-1;
+	attr.prebuf = (uint32_t)-1;
+	attr.fragsize = (uint32_t)-1;
+	attr.tlength = (uint32_t)-1;
+	attr.minreq = (uint32_t)-1;
+	
+	if (record) {
+		attr.fragsize = len;
+	} else {
+		attr.tlength = len;
+		/* Power saving refills half the buffer at a time */
+		attr.minreq = (p == LATENCY_POWER) ? len/2 : (uint32_t)-1;
 	}
+	return attr;
+}
 
-	pa_stream_write(s, bh, nbytes, my_free, 0, PA_SEEK_RELATIVE);
+/* Room for a few fragments and at least RING_SECONDS of audio */
+static size_t ring_size(const pa_buffer_attr *attr, const pa_sample_spec *spec) {
+	size_t need = pa_usec_to_bytes(RING_SECONDS*PA_USEC_PER_SEC, spec);
+	size_t size = 4096;
 	
-	cur->played_size += nbytes;
+	if (need < 4*(size_t)attr->fragsize) {
+		need = 4*(size_t)attr->fragsize;
+	}
+	while (size < need) {
+		size *= 2;
+	}
+	return size;
+}
 
-	if (bytes_left == 0) {
-		soundrec_stop_playback();
+/* The format a source is recorded in */
+static pa_sample_spec record_spec(Recordable *rec) {
+	pa_sample_spec spec = ss;
+	
+	if (native && pa_sample_spec_valid(&rec->spec)) {
+		spec = rec->spec;
+		spec.format = storable(spec.format);
 	}
+	return spec;
 }
 
-size_t soundrec_start_recording(Recordable *rec) {
+/* Called with the mainloop lock held */
+static void connect_session(Session *sn, Recordable *rec, const pa_sample_spec *spec, pa_stream_flags_t flags) {
 	Input *inp;
 	Device *dev;
-	const char *name;
-	
-	assert(state == IDLE);
-	assert(rec != NULL);
+	pa_buffer_attr attr = buffer_attr(true, rec_latency, spec);
 	
-	state = RECORDING;
-	cur = new Clip();
-	 
-	rs = pa_stream_new(ctx, "Record", &ss, NULL);
+	sn->s = pa_stream_new(ctx, "Record", spec, NULL);
 	
-	pa_stream_set_read_callback(rs, read_cb, NULL);
+	pa_stream_set_read_callback(sn->s, read_cb, sn);
 	
 	if (rec->type == INPUT) {
 		inp = static_cast<Input*>(rec);
-		pa_stream_set_monitor_stream(rs, inp->index);
+		pa_stream_set_monitor_stream(sn->s, inp->index);
 		
 		dev = monitor_map[inp->sink];
 	} else {
 		dev = static_cast<Device*>(rec);
 	}
-	name = dev->name.c_str();
 	
-	pa_stream_connect_record(rs, name, NULL, (pa_stream_flags_t)0);
+	pa_stream_connect_record(sn->s, dev->name.c_str(), &attr, 
+			(pa_stream_flags_t)(PA_STREAM_ADJUST_LATENCY | flags));
+}
+
+size_t soundrec_start_recording(Recordable *rec) {
+	pa_sample_spec spec;
+	pa_buffer_attr attr;
+	Session *sn;
 	
-	return cur->id;
+	assert(rec != NULL);
+	
+	spec = record_spec(rec);
+	attr = buffer_attr(true, rec_latency, &spec);
+	
+	sn = new Session(new_recording(spec), spec, ring_size(&attr, &spec));
+	
+	pa_threaded_mainloop_lock(ml);
+	connect_session(sn, rec, &spec, PA_STREAM_NOFLAGS);
+	sessions.push_back(sn);
+	pa_threaded_mainloop_unlock(ml);
+	
+	return sn->clip->id;
 }
 
-void soundrec_start_playback(size_t id) {
-	assert(state == IDLE);
+/* Connects a source to stand by, keeping the last history seconds of it */
+static Session *stand_by(Recordable *rec, double history) {
+	pa_sample_spec spec;
+	pa_buffer_attr attr;
+	Session *sn;
+	
+	spec = record_spec(rec);
+	attr = buffer_attr(true, rec_latency, &spec);
+	
+	sn = new Session(NULL, spec, ring_size(&attr, &spec));
+	sn->history = new History(pa_usec_to_bytes((pa_usec_t)(history*1e6), &spec), sn->meter.frame);
+	return sn;
+}
+
+static void connect_standby(Session *sn, Recordable *rec) {
+	pa_threaded_mainloop_lock(ml);
+	connect_session(sn, rec, &sn->spec, PA_STREAM_NOFLAGS);
+	standby = sn;
+	pa_threaded_mainloop_unlock(ml);
+}
+
+/*
+ * Keeps the source connected and measured, recording a clip whenever it
+ * gets loud; see soundrec_set_trigger(). Only one source can be armed,
+ * and not while another is kept for replay.
+ */
+bool soundrec_arm(Recordable *rec) {
+	Session *sn;
 	
-	state = PLAYING_BACK;
+	assert(rec != NULL);
+	if (standby != NULL) {
+		return false;
+	}
 	
-	cur = Clip::clip_map[id];
-	cur->rewind();
-	cur->played_size = 0;
+	sn = stand_by(rec, trig_preroll);
+	sn->trigger = new Trigger(sn->spec, trig_level);
+	sn->hold = pa_usec_to_bytes((pa_usec_t)(trig_hold*1e6), &sn->spec);
+	connect_standby(sn, rec);
 	
-	ps = pa_stream_new(ctx, "Playback", &ss, NULL);
+	return true;
+}
+
+/*
+ * Keeps the source connected, its last seconds always at hand, so that
+ * soundrec_record_replay() starts a clip from before it was called; see
+ * soundrec_set_replay(). Stopped by soundrec_disarm().
+ */
+bool soundrec_start_replay(Recordable *rec) {
+	assert(rec != NULL);
+	if (standby != NULL || replay_seconds <= 0.0) {
+		return false;
+	}
 	
-	pa_stream_set_write_callback(ps, write_cb, NULL);
-	pa_stream_connect_playback(ps, NULL, NULL, (pa_stream_flags_t)0, NULL, NULL);
+	connect_standby(stand_by(rec, replay_seconds), rec);
+	return true;
 }
 
-void soundrec_save_clip(char *filename, size_t id) {
-	Clip *clip;
-	list<char *>::iterator it;
-	int i, nblocks;
-	size_t bytes_last_block;
-	sf_count_t n;
+/*
+ * Starts a clip on the replay source, beginning with the seconds it kept,
+ * which carries on live until stopped like any other. Returns (size_t)-1
+ * without a replay source or while it is already recording.
+ */
+size_t soundrec_record_replay() {
+	if (standby == NULL || standby->trigger != NULL || standby->clip != NULL) {
+		return (size_t)-1;
+	}
+	
+	/* Catch up first, so the clip starts from the latest audio */
+	drain_ring(standby);
+	seed(standby);
+	return standby->clip->id;
+}
+
+/* Disconnects the armed or replay source, completing its clip if one is running */
+void soundrec_disarm() {
+	Session *sn = standby;
+	
+	if (sn == NULL) {
+		return;
+	}
+	
+	pa_threaded_mainloop_lock(ml);
+	pa_stream_disconnect(sn->s);
+	pa_stream_unref(sn->s);
+	standby = NULL;
+	pa_threaded_mainloop_unlock(ml);
+	
+	drain_last(sn);
+	if (sn->clip != NULL) {
+		end_standby_clip(sn);
+	}
+	
+	if (sn->drain_pending) {
+		sn->stopped = true;
+	} else {
+		delete sn;
+	}
+}
 
-	// For saving with libsndfile
-	SF_INFO sfinfo;
-	sfinfo.samplerate = 44100;
-	sfinfo.channels = 2;
-	sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16 | SF_ENDIAN_LITTLE;
-	sfinfo.frames = cur->rec_size/4;
+bool soundrec_is_armed() {
+	return standby != NULL;
+}
 
-	SNDFILE *f = sf_open(filename, SFM_WRITE, &sfinfo);
-	if (f == NULL) {
-		printf("Save failed: %s\n", sf_strerror(NULL));
+/*
+ * Captures the source to WAV files, cut every so often without stopping
+ * the stream; see soundrec_set_rotate(). Only one source at a time.
+ */
+bool soundrec_start_rotation(Recordable *rec) {
+	pa_sample_spec spec;
+	pa_buffer_attr attr;
+	uint64_t limit = 0, by_size;
+	size_t ring = 4096;
+	Session *sn;
+	
+	assert(rec != NULL);
+	if (rotating != NULL) {
+		return false;
 	}
 	
-	clip = Clip::clip_map[id];
-	assert(clip != NULL);
+	spec = record_spec(rec);
+	attr = buffer_attr(true, rec_latency, &spec);
+	
+	if (rotate_minutes > 0.0) {
+		limit = pa_usec_to_bytes((pa_usec_t)(rotate_minutes*60*PA_USEC_PER_SEC), &spec);
+	}
+	by_size = (uint64_t)(rotate_mbytes*1024*1024);
+	if (by_size > 0 && (limit == 0 || by_size < limit)) {
+		limit = by_size;
+	}
+	while (ring < pa_usec_to_bytes(ROTATE_BUFFER*PA_USEC_PER_SEC, &spec)) {
+		ring *= 2;
+	}
+	
+	sn = new Session(NULL, spec, ring_size(&attr, &spec));
+	sn->rot = new Rotator(spec, rotate_dir.empty() ? g_get_home_dir() : rotate_dir.c_str(),
+			rotate_prefix.c_str(), limit, ring);
+	
+	pa_threaded_mainloop_lock(ml);
+	connect_session(sn, rec, &spec, PA_STREAM_NOFLAGS);
+	rotating = sn;
+	pa_threaded_mainloop_unlock(ml);
 	
-	it = clip->blocks.begin();
-	nblocks = clip->rec_size/BLOCK_SIZE;
+	return true;
+}
 
-	for (i=0; i<nblocks; i++, it++) {
-		n = sf_write_raw(f, *it, BLOCK_SIZE);
-		if (n < 0) {
-			printf("Write failed: %s\n", sf_strerror(NULL));
-		}
+/* Disconnects the source and completes the last file */
+void soundrec_stop_rotation() {
+	Session *sn = rotating;
+	
+	if (sn == NULL) {
+		return;
 	}
+	
+	pa_threaded_mainloop_lock(ml);
+	pa_stream_disconnect(sn->s);
+	pa_stream_unref(sn->s);
+	rotating = NULL;
+	pa_threaded_mainloop_unlock(ml);
+	
+	drain_last(sn);
+	delete sn->rot;
+	sn->rot = NULL;
+	
+	if (sn->drain_pending) {
+		sn->stopped = true;
+	} else {
+		delete sn;
+	}
+}
+
+bool soundrec_is_rotating() {
+	return rotating != NULL;
+}
 
-	bytes_last_block = clip->rec_size - (nblocks*BLOCK_SIZE);
-	n = sf_write_raw(f, *it, bytes_last_block);
+/*
+ * Records all sources into one clip, their channels side by side in the
+ * order given. Returns (size_t)-1 if they have too many channels between them.
+ */
+size_t soundrec_start_multitrack(list<Recordable*> &recs) {
+	vector<pa_sample_spec> specs;
+	list<Recordable*>::iterator it;
+	vector<Session*> sns;
+	pa_buffer_attr attr;
+	Aligner *group;
+	Clip *clip;
+	unsigned i, nch = 0;
+	
+	assert(!recs.empty());
+	
+	for (it = recs.begin(); it != recs.end(); it++) {
+		specs.push_back(record_spec(*it));
+		nch += specs.back().channels;
+	}
+	if (nch > PA_CHANNELS_MAX) {
+		fprintf(stderr, __FILE__": %u channels is too many for one clip\n", nch);
+		return (size_t)-1;
+	}
+	
+	group = new Aligner(specs[0].format, specs);
+	clip = new_recording(group->spec);
 	
-	if (n < 0) {
-		printf("Write failed: %s\n", sf_strerror(NULL));
+	for (i = 0; i < specs.size(); i++) {
+		attr = buffer_attr(true, rec_latency, &specs[i]);
+		sns.push_back(new Session(clip, specs[i], ring_size(&attr, &specs[i])));
+		sns[i]->group = group;
+		sns[i]->track = i;
 	}
+	
+	/* Timing updates keep the latency behind the timestamps current */
+	pa_threaded_mainloop_lock(ml);
+	for (i = 0, it = recs.begin(); it != recs.end(); i++, it++) {
+		connect_session(sns[i], *it, &specs[i], 
+				(pa_stream_flags_t)(PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE));
+		sessions.push_back(sns[i]);
+	}
+	pa_threaded_mainloop_unlock(ml);
+	
+	return clip->id;
+}
+
+void soundrec_start_playback(size_t id) {
+	Clip *clip = Clip::clip_map[id];
+	pa_buffer_attr attr = buffer_attr(false, play_latency, &clip->spec);
+	
+	/* Block pointers must not change under the PulseAudio thread */
+	clip->sync(true);
+	clip->load();
+	
+	/* Recording into it still moves rec_size under the cursor */
+	assert(find_session(id) == NULL);
+	
+	pa_threaded_mainloop_lock(ml);
+	assert(!playing);
+	
+	playing = true;
+	play = Cursor(clip, 0);
+	
+	ps = pa_stream_new(ctx, "Playback", &clip->spec, NULL);
+	
+	pa_stream_set_write_callback(ps, write_cb, NULL);
+	pa_stream_connect_playback(ps, NULL, &attr, PA_STREAM_ADJUST_LATENCY, NULL, NULL);
+	pa_threaded_mainloop_unlock(ml);
+}
+
+/* Saves the clip before returning; see soundrec_save_clip_async() to save in the background */
+void soundrec_save_clip(char *filename, size_t id) {
+	Clip *clip = Clip::clip_map[id];
+	
+	assert(clip != NULL);
+	save_clip(clip, filename);
+}
+
+/*
+ * Queues the clip to be saved by a pool of threads, the done callback
+ * is called on the main loop once it is. Returns false if the clip is
+ * being saved already. With normalize its gain is set to bring it to
+ * the loudness set by soundrec_set_loudness().
+ */
+bool soundrec_save_clip_async(const char *filename, size_t id, bool normalize) {
+	Clip *clip = Clip::clip_map[id];
+	
+	assert(clip != NULL);
+	assert(find_session(id) == NULL);
+	return save_clip_async(clip, filename, normalize);
+}
 
-	if (sf_close(f)) {
-		printf("Error closing\n");
+/* How much of the clip is saved, 0 to 1, or -1 if it isn't being saved */
+double soundrec_get_save_progress(size_t id) {
+	return save_progress(id);
+}
+
+bool soundrec_is_saving() {
+	return save_busy();
+}
+
+bool soundrec_is_mixing() {
+	return mix_busy();
+}
+
+/* Blocks until every queued save is done */
+void soundrec_finish_saves() {
+	save_wait();
+}
+
+/* Compresses clips nobody has recorded, played or read for pack_idle seconds */
+static gboolean pack_cb(void *) {
+	map<size_t,Clip*>::iterator it;
+	int64_t now = g_get_monotonic_time();
+	Clip *playing_clip;
+	
+	clip_reap();
+	
+	pa_threaded_mainloop_lock(ml);
+	playing_clip = playing ? play.clip : NULL;
+	pa_threaded_mainloop_unlock(ml);
+	
+	for (it = Clip::clip_map.begin(); it != Clip::clip_map.end(); it++) {
+		Clip *c = it->second;
+		
+		/* Idle time only counts once recording and playback are over */
+		if (!c->finished || c == playing_clip) {
+			c->touched = now;
+		} else if (pack_idle > 0 && now - c->touched >= pack_idle*(int64_t)1000000) {
+			c->pack();
+		}
 	}
+	pool_trim();
+	
+	return TRUE;
 }
 
 void soundrec_init() {
-	pa_glib_mainloop *ml;
 	pa_mainloop_api *api;
 	
-	ml  = pa_glib_mainloop_new(NULL);
-	api = pa_glib_mainloop_get_api(ml);
+	pool_fill();
+	g_timeout_add_seconds(PACK_INTERVAL, pack_cb, NULL);
+	
+	ml  = pa_threaded_mainloop_new();
+	api = pa_threaded_mainloop_get_api(ml);
 	ctx = pa_context_new(api, "SoundRecorder");
 	
+	pa_threaded_mainloop_lock(ml);
 	pa_context_set_state_callback(ctx, connect_cb, NULL);
 	pa_context_connect(ctx, NULL, (pa_context_flags_t)0, NULL);
+	
+	if (pa_threaded_mainloop_start(ml) < 0) {
+		fprintf(stderr, __FILE__": failed to start mainloop thread\n");
+	}
+	pa_threaded_mainloop_unlock(ml);
 }
 
 rec_state soundrec_get_state() {
-	return state;
+	rec_state s = IDLE;
+	
+	pa_threaded_mainloop_lock(ml);
+	if (soundrec_is_recording()) {
+		s = RECORDING;
+	} else if (playing) {
+		s = PLAYING_BACK;
+	}
+	pa_threaded_mainloop_unlock(ml);
+	
+	return s;
+}
+
+/* Armed sources count only while they record a clip */
+bool soundrec_is_recording() {
+	return !sessions.empty() || (standby != NULL && standby->clip != NULL);
+}
+
+bool soundrec_is_playing() {
+	bool p;
+	
+	pa_threaded_mainloop_lock(ml);
+	p = playing;
+	pa_threaded_mainloop_unlock(ml);
+	
+	return p;
+}
+
+bool soundrec_clip_recording(size_t id) {
+	return find_session(id) != NULL;
+}
+
+/* Whether the clip is being recorded or played back */
+bool soundrec_clip_in_use(size_t id) {
+	bool used;
+	
+	pa_threaded_mainloop_lock(ml);
+	used = (playing && play.clip->id == id) || find_session(id) != NULL || save_progress(id) >= 0.0 || mix_uses(id);
+	pa_threaded_mainloop_unlock(ml);
+	
+	return used;
 }
 
 double soundrec_get_progress() {
-	return ((double)cur->played_size)/cur->rec_size;
+	double p;
+	
+	pa_threaded_mainloop_lock(ml);
+	p = ((double)play.pos)/play.clip->rec_size;
+	pa_threaded_mainloop_unlock(ml);
+	
+	return p;
 }
 
-size_t soundrec_get_pcm(size_t id, size_t start, size_t nbytes, char ***data, size_t **size, size_t *nfrag) {
-	Clip *c;
-	list<char*>::iterator it;
-	size_t pos, begin, rem1, rem2, end, i, eob;
+/* Progress of a running recording; the level is the peak since the last call */
+bool soundrec_get_stats(size_t id, rec_stats *st) {
+	list<Session*> found;
+	list<Session*>::iterator it;
+	float lv;
+	
+	st->dropped = 0;
+	st->level = 0.0f;
+	
+	/* A multi-track clip has a session per track */
+	for (it = sessions.begin(); it != sessions.end(); it++) {
+		if ((*it)->clip->id == id) {
+			found.push_back(*it);
+		}
+	}
+	if (standby != NULL && find_session(id) == standby) {
+		found.push_back(standby);
+	}
 	
+	for (it = found.begin(); it != found.end(); it++) {
+		st->bytes = (*it)->clip->rec_size;
+		st->backlog = (*it)->clip->backlog();
+		st->dropped += (*it)->lost + (*it)->dropped.load();
+		lv = (*it)->level.exchange(0.0f);
+		if (lv > st->level) {
+			st->level = lv;
+		}
+	}
+	
+	return !found.empty();
+}
+
+/* Clamps a range to the recorded part of a clip, returning its length */
+static size_t pcm_range(size_t id, size_t start, size_t nbytes, Clip **c) {
 	assert(Clip::clip_map.count(id) > 0);
-	c = Clip::clip_map[id];
+	*c = Clip::clip_map[id];
+	(*c)->sync(false);
 	
-	if (start >= c->rec_size) {
+	/* Blocks of a clip still being encoded may be gone already */
+	if (!(*c)->load(start, nbytes) || start >= (*c)->rec_size) {
 		return 0;
 	}
+	if (start + nbytes > (*c)->rec_size) {
+		nbytes = (*c)->rec_size - start;
+	}
+	return nbytes;
+}
+
+/*
+ * The fragments handed out below stay valid until control returns to the
+ * main loop, which may compress the blocks of a clip left alone for long.
+ */
+
+/*
+ * Fills at most maxfrag fragments of the range into the caller's array
+ * without allocating; returns the number of bytes they cover.
+ */
+size_t soundrec_get_pcm_view(size_t id, size_t start, size_t nbytes, pcm_frag *frags, size_t maxfrag, size_t *nfrag) {
+	Clip *c;
+	size_t end, covered = 0;
+	
+	nbytes = pcm_range(id, start, nbytes, &c);
+	end = start+nbytes;
 	
-	if (start + nbytes > c->rec_size) {
-		nbytes = c->rec_size - start;
-	} 
+	Cursor cr(c, start);
 	
-	begin = BLOCK_SIZE*(start/BLOCK_SIZE);
-	rem1 = BLOCK_SIZE-(start-begin);
-	rem2 = nbytes-(BLOCK_SIZE*(nbytes/BLOCK_SIZE));
+	for (*nfrag = 0; *nfrag < maxfrag && cr.pos < end; (*nfrag)++) {
+		frags[*nfrag].size = cr.next(&frags[*nfrag].data, end-cr.pos);
+		covered += frags[*nfrag].size;
+	}
+	
+	return covered;
+}
+
+/* Calls cb on every contiguous fragment of the range, in order */
+size_t soundrec_visit_pcm(size_t id, size_t start, size_t nbytes, void (*cb)(const char *, size_t, void *), void *data) {
+	Clip *c;
+	const char *ptr;
+	size_t n, end;
+	
+	nbytes = pcm_range(id, start, nbytes, &c);
 	end = start+nbytes;
 	
-	*nfrag = (size_t)ceil(((double)nbytes)/BLOCK_SIZE);
+	Cursor cr(c, start);
 	
-	if (rem1 < rem2) {
-		*nfrag += 1;
+	while (cr.pos < end && (n = cr.next(&ptr, end-cr.pos)) > 0) {
+		cb(ptr, n, data);
 	}
 	
+	return nbytes;
+}
+
+/* Allocating variant, the caller frees data and size */
+size_t soundrec_get_pcm(size_t id, size_t start, size_t nbytes, char ***data, size_t **size, size_t *nfrag) {
+	Clip *c;
+	const char *ptr;
+	size_t end, i;
+	
+	nbytes = pcm_range(id, start, nbytes, &c);
+	if (nbytes == 0) {
+		return 0;
+	}
+	
+	end = start+nbytes;
+	
+	*nfrag = (end-1)/BLOCK_SIZE - start/BLOCK_SIZE + 1;
+	
 	*data = (char **)calloc(*nfrag, sizeof(char *));
 	*size = (size_t *)calloc(*nfrag, sizeof(size_t));
 	
-	for (it = c->blocks.begin(), pos = 0; 
-			pos+BLOCK_SIZE < start; 
-				it++, pos += BLOCK_SIZE);
-	
-	for (i=0, pos = start; 
-			pos < end; 
-				i++, it++) {
-		(*data)[i] = (*it)+(pos%BLOCK_SIZE);
-		eob = (size_t)BLOCK_SIZE*((pos/BLOCK_SIZE)+1);
-		if (eob > end) {
-			(*size)[i] = end-pos;
-			break;
-		} else {
-			(*size)[i] = eob-pos;
-		}
-		pos = BLOCK_SIZE+(BLOCK_SIZE*(pos/BLOCK_SIZE));
+	Cursor cr(c, start);
+	
+	for (i=0; i<*nfrag; i++) {
+		(*size)[i] = cr.next(&ptr, end-cr.pos);
+		(*data)[i] = (char *)ptr;
 	}
 	
 	return nbytes;
@@ -565,14 +1365,107 @@ void soundrec_delete_clip(size_t id) {
 	Clip *clip = Clip::clip_map[id];
 	
 	assert(clip != NULL);
+	assert(!soundrec_clip_in_use(id));
 	
-	if (clip == cur) {
-		assert(state != RECORDING);
-		assert(state != PLAYING_BACK);
-		cur = NULL;
+	delete clip;
+	pool_fill();
+}
+
+static void mixed(Clip *clip, void *) {
+	pool_fill();
+	if (user_mix_cb != NULL) {
+		user_mix_cb(clip->id);
 	}
+}
+
+/*
+ * Sums finished clips of the same rate into a new stereo clip in the
+ * background, returning its id, or (size_t)-1 if they can't be mixed.
+ * The mix callback gets the id once the clip is complete.
+ */
+size_t soundrec_mix_clips(const mix_input *in, size_t n) {
+	vector<MixSource> src;
+	Clip *c;
+	size_t i;
 	
-	delete clip;
+	for (i = 0; i < n; i++) {
+		assert(Clip::clip_map.count(in[i].id) > 0);
+		c = Clip::clip_map[in[i].id];
+		
+		if (find_session(in[i].id) != NULL) {
+			fprintf(stderr, __FILE__": can't mix clip %zu while recording it\n", in[i].id);
+			return (size_t)-1;
+		}
+		if (i > 0 && c->spec.rate != src[0].clip->spec.rate) {
+			fprintf(stderr, __FILE__": can't mix clips of different rates\n");
+			return (size_t)-1;
+		}
+		
+		/* Workers read block pointers, which must be settled */
+		c->sync(true);
+		c->load();
+		src.push_back(MixSource(c, in[i].offset*(int64_t)c->spec.rate/1000000, in[i].gain));
+	}
+	
+	if (src.empty()) {
+		return (size_t)-1;
+	}
+	
+	c = mix_clips(src, store, mixed, NULL);
+	return c->id;
+}
+
+/* When the clip started recording, on the monotonic clock in microseconds */
+int64_t soundrec_get_start_time(size_t id) {
+	assert(Clip::clip_map.count(id) > 0);
+	return Clip::clip_map[id]->started;
+}
+
+/* Bytes of memory holding the clip's audio, less once it has been compressed */
+size_t soundrec_get_clip_memory(size_t id) {
+	assert(Clip::clip_map.count(id) > 0);
+	return Clip::clip_map[id]->memory();
+}
+
+/*
+ * EBU R128 integrated loudness in LUFS and true peak in dBTP, measured as
+ * the clip was recorded. False if it is too short or quiet to measure.
+ */
+bool soundrec_get_loudness(size_t id, double *lufs, double *true_peak) {
+	Clip *c;
+	
+	assert(Clip::clip_map.count(id) > 0);
+	c = Clip::clip_map[id];
+	*lufs = c->meter->integrated();
+	*true_peak = 20.0*log10(c->meter->true_peak());
+	return !std::isinf(*lufs);
+}
+
+/*
+ * Where quiet was left out of the clip, in order; fills at most max and
+ * returns how many there are. Putting length frames of silence back at
+ * every frame restores the timeline of the recording.
+ */
+size_t soundrec_get_gaps(size_t id, clip_gap *gaps, size_t max) {
+	Clip *c;
+	size_t i, n;
+	
+	assert(Clip::clip_map.count(id) > 0);
+	c = Clip::clip_map[id];
+	if (c->trim == NULL) {
+		return 0;
+	}
+	
+	n = c->trim->gaps.size();
+	for (i = 0; i < n && i < max; i++) {
+		gaps[i] = c->trim->gaps[i];
+	}
+	return n;
+}
+
+void soundrec_get_sample_spec(size_t id, pa_sample_spec *spec) {
+	assert(Clip::clip_map.count(id) > 0);
+	*spec = Clip::clip_map[id]->spec;
 }
 
 void soundrec_set_inputs_cb(void (*cb)(list<Input*>&, map<uint32_t,update_t>&)) {
@@ -586,3 +1479,174 @@ void soundrec_set_sources_cb(void (*cb)(list<Device*> &, list<Device*> &)) {
 void soundrec_set_pcm_cb(void (*cb)(size_t)) {
 	user_pcm_cb = cb;
 }
+
+/* Called on the main loop with the id of every clip the armed source starts */
+void soundrec_set_trigger_cb(void (*cb)(size_t)) {
+	user_trigger_cb = cb;
+}
+
+/* Called on the main loop with the id of every mix once it is complete */
+void soundrec_set_mix_cb(void (*cb)(size_t)) {
+	user_mix_cb = cb;
+}
+
+void soundrec_set_store(clip_store s) {
+	store = s;
+}
+
+/* Compress clips while recording; CODEC_NONE keeps raw PCM */
+void soundrec_set_codec(clip_codec c) {
+	codec = c;
+}
+
+void soundrec_set_spool_dir(const char *dir) {
+	clip_set_spool_dir(dir);
+}
+
+/*
+ * An armed source starts a clip once its RMS level reaches level (0 to 1),
+ * beginning preroll seconds before, and ends it after hold seconds below.
+ */
+void soundrec_set_trigger(float level, double preroll, double hold) {
+	trig_level = level;
+	trig_preroll = preroll;
+	trig_hold = hold;
+}
+
+/*
+ * Rotated files go into dir as prefix, with any strftime() conversions
+ * filled in, and a running number. A file is cut after minutes or
+ * megabytes of audio, whichever comes first; 0 for either leaves it out.
+ */
+void soundrec_set_rotate(const char *dir, const char *prefix, double minutes, double megabytes) {
+	if (dir != NULL) {
+		rotate_dir = dir;
+	}
+	if (prefix != NULL) {
+		rotate_prefix = prefix;
+	}
+	rotate_minutes = minutes;
+	rotate_mbytes = megabytes;
+}
+
+/* Files saves may write at once, however many clips are saved in parallel */
+void soundrec_set_save_writers(unsigned n) {
+	save_set_writers(n);
+}
+
+/*
+ * Converts saved clips to the format, rate and channels of ss, each left
+ * as the clip has it where PA_SAMPLE_INVALID or 0, with TPDF dither on
+ * integer formats if dither is set.
+ */
+void soundrec_set_export(const pa_sample_spec *ss, bool dither) {
+	save_set_export(ss, dither);
+}
+
+/* What normalising on save aims for, and the true peak it stays under */
+void soundrec_set_loudness(double target, double true_peak) {
+	save_set_loudness(target, true_peak);
+}
+
+void soundrec_set_save_cb(void (*cb)(size_t, bool)) {
+	save_set_done_cb(cb);
+}
+
+/* Seconds the replay source keeps, 0 for none; for sources started after */
+void soundrec_set_replay(double seconds) {
+	replay_seconds = seconds;
+}
+
+/*
+ * Leaves out of new recordings any stretch whose RMS level stays below
+ * level (0 to 1, 0 for never) for more than hangover seconds, keeping
+ * pad seconds at either edge.
+ */
+void soundrec_set_trim(float level, double hangover, double pad) {
+	trim_level = level;
+	trim_hangover = hangover;
+	trim_pad = pad;
+}
+
+/* Peak level, 0 to 1, at or below which a whole block is stored as silence */
+void soundrec_set_silence_floor(float level) {
+	clip_set_silence_floor(level);
+}
+
+void soundrec_set_pool(size_t prealloc, size_t high_water) {
+	pool_set_limits(prealloc, high_water);
+}
+
+/* Seconds a finished clip may go unused before it is compressed, 0 for never */
+void soundrec_set_pack_idle(unsigned seconds) {
+	pack_idle = seconds;
+}
+
+/* NULL records every source in its own native format */
+void soundrec_set_sample_spec(const pa_sample_spec *spec) {
+	native = (spec == NULL);
+	if (spec != NULL) {
+		ss = *spec;
+		ss.format = storable(ss.format);
+	}
+}
+
+/* Whether the UI records several selected sources into one aligned clip */
+void soundrec_set_multitrack(bool on) {
+	multitrack = on;
+}
+
+bool soundrec_get_multitrack() {
+	return multitrack;
+}
+
+static const char *latency_names[] = { "low", "balanced", "power" };
+
+const char *soundrec_latency_name(latency_profile p) {
+	return latency_names[p];
+}
+
+bool soundrec_parse_latency(const char *name, latency_profile *p) {
+	for (int i=0; i<3; i++) {
+		if (strcmp(name, latency_names[i]) == 0) {
+			*p = (latency_profile)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void soundrec_set_latency(bool record, latency_profile p) {
+	if (record) {
+		rec_latency = p;
+	} else {
+		play_latency = p;
+	}
+}
+
+latency_profile soundrec_get_latency(bool record) {
+	return record ? rec_latency : play_latency;
+}
+
+/* The buffer length the active stream negotiated, or 0 */
+uint64_t soundrec_get_latency_usec(bool record) {
+	const pa_buffer_attr *attr;
+	pa_stream *s;
+	uint64_t usec = 0;
+	
+	pa_threaded_mainloop_lock(ml);
+	if (record) {
+		/* The most recently started recording */
+		s = sessions.empty() ? NULL : sessions.back()->s;
+	} else {
+		s = playing ? ps : NULL;
+	}
+	if (s != NULL && pa_stream_get_state(s) == PA_STREAM_READY) {
+		attr = pa_stream_get_buffer_attr(s);
+		usec = pa_bytes_to_usec(record ? attr->fragsize : attr->tlength, 
+				pa_stream_get_sample_spec(s));
+	}
+	pa_threaded_mainloop_unlock(ml);
+	
+	return usec;
+}
@@ -7,10 +7,24 @@
 #include <cstdint>
 #include <string>
 
+#include <pulse/sample.h>
+
 enum rec_state {
 	IDLE, RECORDING, PLAYING_BACK
 };
 
+enum clip_store {
+	STORE_MEMORY, STORE_SPOOL, STORE_MAPPED
+};
+
+enum clip_codec {
+	CODEC_NONE, CODEC_FLAC, CODEC_OPUS, CODEC_VORBIS
+};
+
+enum latency_profile {
+	LATENCY_LOW, LATENCY_BALANCED, LATENCY_POWER
+};
+
 enum rec_type {
 	INPUT, DEVICE
 };
@@ -18,7 +32,8 @@ enum rec_type {
 class Recordable {
 	public: 
 		rec_type type;
-		Recordable(rec_type t) : type(t) {}
+		pa_sample_spec spec;
+		Recordable(rec_type t, const pa_sample_spec &ss) : type(t), spec(ss) {}
 		
 };
 
@@ -28,7 +43,7 @@ class Input :
 		uint32_t sink;
 		uint32_t index;
 		std::map<std::string,std::string> props;
-		Input(uint32_t s, uint32_t i) : Recordable(INPUT), sink(s), index(i) {}
+		Input(uint32_t s, uint32_t i, const pa_sample_spec &ss) : Recordable(INPUT, ss), sink(s), index(i) {}
 };
 
 class Device : 
@@ -36,29 +51,107 @@ class Device :
 	public:
 		std::string name;
 		uint32_t index;
-		Device(const char *n, uint32_t i) : Recordable(DEVICE), name(n), index(i) {}
+		Device(const char *n, uint32_t i, const pa_sample_spec &ss) : Recordable(DEVICE, ss), name(n), index(i) {}
 };
 
 typedef enum {
 	NOUPDATE, NEW, CHANGE, REMOVE
 } update_t;
 
+typedef struct {
+	const char *data;
+	size_t size;
+} pcm_frag;
+
+/* A clip to mix, starting offset microseconds into the mix */
+typedef struct {
+	size_t id;
+	int64_t offset;
+	float gain;
+} mix_input;
+
+/* length frames of quiet were left out of a clip at frame */
+typedef struct {
+	uint64_t frame;
+	uint64_t length;
+} clip_gap;
+
+typedef struct {
+	size_t bytes;
+	size_t dropped;
+	size_t backlog;
+	float level;
+} rec_stats;
+
 void soundrec_start_playback(size_t id);
 size_t soundrec_start_recording(Recordable *rec);
+size_t soundrec_start_multitrack(std::list<Recordable*> &recs);
 void soundrec_stop_playback();
 void soundrec_stop_recording();
+void soundrec_stop_recording_clip(size_t id);
+bool soundrec_arm(Recordable *rec);
+void soundrec_disarm();
+bool soundrec_is_armed();
+bool soundrec_start_replay(Recordable *rec);
+size_t soundrec_record_replay();
+bool soundrec_start_rotation(Recordable *rec);
+void soundrec_stop_rotation();
+bool soundrec_is_rotating();
 
 void soundrec_delete_clip(size_t id);
+size_t soundrec_mix_clips(const mix_input *in, size_t n);
 void soundrec_save_clip(char *filename, size_t id);
+bool soundrec_save_clip_async(const char *filename, size_t id, bool normalize = false);
+double soundrec_get_save_progress(size_t id);
+bool soundrec_is_saving();
+bool soundrec_is_mixing();
+void soundrec_finish_saves();
 
 rec_state soundrec_get_state();
+bool soundrec_is_recording();
+bool soundrec_is_playing();
+bool soundrec_clip_recording(size_t id);
+bool soundrec_clip_in_use(size_t id);
 double soundrec_get_progress();
+bool soundrec_get_stats(size_t id, rec_stats *st);
+int64_t soundrec_get_start_time(size_t id);
+size_t soundrec_get_clip_memory(size_t id);
+bool soundrec_get_loudness(size_t id, double *lufs, double *true_peak);
+size_t soundrec_get_gaps(size_t id, clip_gap *gaps, size_t max);
+void soundrec_get_sample_spec(size_t id, pa_sample_spec *ss);
 size_t soundrec_get_pcm(size_t id, size_t start, size_t nbytes, char ***data, size_t **size, size_t *nfrag);
+size_t soundrec_get_pcm_view(size_t id, size_t start, size_t nbytes, pcm_frag *frags, size_t maxfrag, size_t *nfrag);
+size_t soundrec_visit_pcm(size_t id, size_t start, size_t nbytes, void (*cb)(const char *, size_t, void *), void *data);
 
 void soundrec_init();
 
 void soundrec_set_inputs_cb(void (*cb)(std::list<Input*> &, std::map<uint32_t, update_t> &));
 void soundrec_set_sources_cb(void (*cb)(std::list<Device*> &, std::list<Device*> &));
 void soundrec_set_pcm_cb(void (*cb)(size_t));
+void soundrec_set_trigger_cb(void (*cb)(size_t));
+void soundrec_set_mix_cb(void (*cb)(size_t));
+void soundrec_set_save_cb(void (*cb)(size_t, bool));
+
+void soundrec_set_store(clip_store store);
+void soundrec_set_spool_dir(const char *dir);
+void soundrec_set_codec(clip_codec c);
+void soundrec_set_silence_floor(float level);
+void soundrec_set_trim(float level, double hangover, double pad);
+void soundrec_set_trigger(float level, double preroll, double hold);
+void soundrec_set_replay(double seconds);
+void soundrec_set_save_writers(unsigned n);
+void soundrec_set_export(const pa_sample_spec *ss, bool dither);
+void soundrec_set_loudness(double target, double true_peak);
+void soundrec_set_rotate(const char *dir, const char *prefix, double minutes, double megabytes);
+void soundrec_set_pool(size_t prealloc, size_t high_water);
+void soundrec_set_pack_idle(unsigned seconds);
+void soundrec_set_sample_spec(const pa_sample_spec *ss);
+void soundrec_set_latency(bool record, latency_profile p);
+void soundrec_set_multitrack(bool on);
+bool soundrec_get_multitrack();
+latency_profile soundrec_get_latency(bool record);
+uint64_t soundrec_get_latency_usec(bool record);
+const char *soundrec_latency_name(latency_profile p);
+bool soundrec_parse_latency(const char *name, latency_profile *p);
 
 #endif
@@ -0,0 +1,227 @@
+
+#include <cmath>
+#include <cstdio>
+#include <cassert>
+
+#include "soundrec_align.hpp"
+
+using namespace std;
+
+/* Capture history needed before the measured rates are trusted */
+#define DRIFT_WINDOW 2000000
+/* Largest correction allowed against the nominal rate ratio */
+#define DRIFT_MAX 0.005
+/* Seconds the reference track may wait for the others' timestamps */
+#define ALIGN_WAIT 2
+/* Output frames interpolated per pass */
+#define MIX_CHUNK 4096
+
+Aligner::Aligner(pa_sample_format_t format, const vector<pa_sample_spec> &in) : aligned(false) {
+	size_t i;
+	
+	assert(!in.empty());
+	
+	spec.format = format;
+	spec.rate = in[0].rate;
+	spec.channels = 0;
+	
+	for (i = 0; i < in.size(); i++) {
+		tracks.push_back(Track(in[i], (double)in[i].rate/in[0].rate));
+		spec.channels += in[i].channels;
+	}
+	assert(spec.channels <= PA_CHANNELS_MAX);
+	
+	k = dsp_kernels(&spec);
+}
+
+static void drop_head(Track &tr) {
+	size_t n = tr.frames();
+	
+	if (n > tr.skip) {
+		n = tr.skip;
+	}
+	tr.buf.erase(tr.buf.begin(), tr.buf.begin() + n*tr.spec.channels);
+	tr.head += n;
+	tr.skip -= n;
+}
+
+/*
+ * Every track's first frame is dated by its first timestamp; whatever the
+ * earlier starters captured before the latest one began is dropped.
+ * Tracks that never reported a timestamp are taken to start at that point.
+ */
+void Aligner::align() {
+	vector<double> start(tracks.size());
+	double latest = 0.0;
+	size_t i;
+	
+	for (i = 0; i < tracks.size(); i++) {
+		Track &tr = tracks[i];
+		
+		if (tr.marked) {
+			start[i] = tr.first_usec - tr.first_frame*1e6/tr.spec.rate;
+			if (start[i] > latest) {
+				latest = start[i];
+			}
+		}
+	}
+	
+	for (i = 0; i < tracks.size(); i++) {
+		Track &tr = tracks[i];
+		
+		if (tr.marked) {
+			tr.skip = (uint64_t)llround((latest - start[i])*tr.spec.rate/1e6);
+			drop_head(tr);
+		}
+	}
+	
+	aligned = true;
+}
+
+static void append(Track &tr, const char *data, size_t frames) {
+	size_t old = tr.buf.size();
+	
+	tr.buf.resize(old + frames*tr.spec.channels);
+	tr.k.to_float(data, &tr.buf[old], frames, tr.spec.channels);
+}
+
+/* Takes any number of bytes, a frame split between calls is put back together */
+void Aligner::feed(unsigned t, const char *data, size_t nbytes) {
+	Track &tr = tracks[t];
+	const size_t frame = tr.k.frame;
+	size_t n;
+	
+	if (!tr.part.empty()) {
+		n = frame - tr.part.size() < nbytes ? frame - tr.part.size() : nbytes;
+		tr.part.insert(tr.part.end(), data, data + n);
+		data += n;
+		nbytes -= n;
+		if (tr.part.size() < frame) {
+			return;
+		}
+		append(tr, &tr.part[0], 1);
+		tr.part.clear();
+	}
+	
+	n = nbytes/frame;
+	append(tr, data, n);
+	tr.part.assign(data + n*frame, data + nbytes);
+	
+	if (aligned) {
+		drop_head(tr);
+	} else if (t == 0 && tr.frames() > ALIGN_WAIT*(size_t)tr.spec.rate) {
+		fprintf(stderr, __FILE__": no timing for some tracks, aligning without it\n");
+		align();
+	}
+}
+
+/* Frame number frame of track t was captured at usec */
+void Aligner::mark(unsigned t, uint64_t frame, uint64_t usec) {
+	Track &tr = tracks[t];
+	Track &ref = tracks[0];
+	double rate, ref_rate, when, err, target;
+	size_t i;
+	
+	if (!tr.marked) {
+		tr.marked = true;
+		tr.first_frame = frame;
+		tr.first_usec = usec;
+		
+		for (i = 0; i < tracks.size() && tracks[i].marked; i++);
+		if (i == tracks.size() && !aligned) {
+			align();
+		}
+	}
+	tr.last_frame = frame;
+	tr.last_usec = usec;
+	
+	if (t == 0 || tr.last_usec - tr.first_usec < DRIFT_WINDOW ||
+			ref.last_usec - ref.first_usec < DRIFT_WINDOW) {
+		return;
+	}
+	
+	rate = (double)(tr.last_frame - tr.first_frame)/(tr.last_usec - tr.first_usec);
+	ref_rate = (double)(ref.last_frame - ref.first_frame)/(ref.last_usec - ref.first_usec);
+	
+	/*
+	 * Where the track should be, given the time the reference has reached:
+	 * the rate ratio alone leaves whatever drifted before it was known.
+	 */
+	when = ref.first_usec + (ref.head + ref.pos - ref.first_frame)/ref_rate;
+	err = tr.first_frame + (when - tr.first_usec)*rate - (tr.head + tr.pos);
+	
+	/* Take a second to make up the difference */
+	target = rate/ref_rate + err/spec.rate;
+	if (target > tr.nominal*(1.0 + DRIFT_MAX)) {
+		target = tr.nominal*(1.0 + DRIFT_MAX);
+	} else if (target < tr.nominal*(1.0 - DRIFT_MAX)) {
+		target = tr.nominal*(1.0 - DRIFT_MAX);
+	}
+	/* The estimate is over the whole recording, ease into it all the same */
+	tr.ratio += (target - tr.ratio)/8;
+}
+
+/* Interleaves every frame all tracks can supply into clip, returns bytes added */
+size_t Aligner::mix(Clip *clip) {
+	size_t n, j, c, i, off, idx, used, total = 0;
+	double lim, p, f;
+	
+	if (!aligned) {
+		return 0;
+	}
+	
+	for (;;) {
+		n = MIX_CHUNK;
+		for (i = 0; i < tracks.size(); i++) {
+			Track &tr = tracks[i];
+			
+			/* Interpolation reads one frame past the position */
+			lim = (double)tr.frames() - 2.0 - tr.pos;
+			if (lim < 0.0) {
+				n = 0;
+				break;
+			}
+			if ((size_t)(lim/tr.ratio) + 1 < n) {
+				n = (size_t)(lim/tr.ratio) + 1;
+			}
+		}
+		if (n == 0) {
+			break;
+		}
+		
+		mixbuf.resize(n*spec.channels);
+		
+		for (i = 0, off = 0; i < tracks.size(); i++) {
+			Track &tr = tracks[i];
+			const unsigned ch = tr.spec.channels;
+			
+			for (j = 0; j < n; j++) {
+				p = tr.pos + j*tr.ratio;
+				idx = (size_t)p;
+				f = p - idx;
+				for (c = 0; c < ch; c++) {
+					float a = tr.buf[idx*ch + c];
+					float b = tr.buf[(idx+1)*ch + c];
+					mixbuf[j*spec.channels + off + c] = a + (b - a)*(float)f;
+				}
+			}
+			
+			tr.pos += n*tr.ratio;
+			used = (size_t)tr.pos;
+			if (used > tr.frames()) {
+				used = tr.frames();
+			}
+			tr.buf.erase(tr.buf.begin(), tr.buf.begin() + used*ch);
+			tr.head += used;
+			tr.pos -= used;
+			off += ch;
+		}
+		
+		outbuf.resize(n*k.frame);
+		k.from_float(&mixbuf[0], &outbuf[0], n, spec.channels);
+		clip->record(&outbuf[0], outbuf.size());
+		total += outbuf.size();
+	}
+	
+	return total;
+}
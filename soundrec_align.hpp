@@ -0,0 +1,61 @@
+#ifndef _SOUNDREC_ALIGN_HEADER_
+#define _SOUNDREC_ALIGN_HEADER_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <pulse/sample.h>
+
+#include "soundrec_clip.hpp"
+#include "soundrec_dsp.hpp"
+
+/* One input of a multi-track recording, kept as float until it is mixed */
+class Track {
+	public:
+		pa_sample_spec spec;
+		Kernels k;
+		std::vector<float> buf;
+		uint64_t head;
+		double pos;
+		double ratio;
+		double nominal;
+		uint64_t skip;
+		bool marked;
+		uint64_t first_frame;
+		uint64_t first_usec;
+		uint64_t last_frame;
+		uint64_t last_usec;
+		/* Bytes of a frame the last feed ended in the middle of */
+		std::vector<char> part;
+		Track(const pa_sample_spec &ss, double r) : spec(ss), k(dsp_kernels(&ss)),
+				head(0), pos(0.0), ratio(r), nominal(r), skip(0), marked(false),
+				first_frame(0), first_usec(0), last_frame(0), last_usec(0) {}
+		size_t frames() {
+			return buf.size()/spec.channels;
+		}
+};
+
+/*
+ * Lines tracks up on a common timeline from their capture timestamps and
+ * interleaves them into one clip. The first track is the reference clock,
+ * the others follow it through a linear resampler whose ratio tracks the
+ * rate each one actually delivers.
+ */
+class Aligner {
+	private:
+		bool aligned;
+		std::vector<float> mixbuf;
+		std::vector<char> outbuf;
+		void align();
+	public:
+		std::vector<Track> tracks;
+		pa_sample_spec spec;
+		Kernels k;
+		Aligner(pa_sample_format_t format, const std::vector<pa_sample_spec> &in);
+		void feed(unsigned t, const char *data, size_t nbytes);
+		void mark(unsigned t, uint64_t frame, uint64_t usec);
+		size_t mix(Clip *clip);
+};
+
+#endif
@@ -0,0 +1,753 @@
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "soundrec_clip.hpp"
+#include "soundrec_pool.hpp"
+#include "soundrec_pack.hpp"
+
+using namespace std;
+
+/* Address space reserved for the view of a spool or backing file */
+#define MAP_RESERVE ((size_t)1 << (sizeof(size_t) > 4 ? 36 : 30))
+/* Full blocks allowed in flight between recording and the writer thread */
+#define SPOOL_QUEUE 4
+/* Full blocks handed to a clip's encoder at once; more means it is behind */
+#define ENCODE_QUEUE 4
+
+enum job_kind { JOB_SPOOL, JOB_ENCODE, JOB_PACK };
+
+class SpoolJob {
+	public:
+		Clip *clip;
+		size_t blk;
+		char *data;
+		size_t offset;
+		size_t len;
+		bool ok;
+		job_kind kind;
+		/* Packing: the result, and when the clip was last touched before it */
+		char *packed;
+		size_t packed_len;
+		int64_t stamp;
+		SpoolJob(Clip *c, size_t b, size_t o, size_t l) : clip(c), blk(b), data(c->blocks[b]),
+				offset(o), len(l), ok(false), kind(JOB_SPOOL), packed(NULL), packed_len(0), stamp(0) {}
+		/* Closes the clip's encoder */
+		SpoolJob(Clip *c) : clip(c), blk((size_t)-1), data(NULL), offset(0), len(0), ok(false),
+				kind(JOB_ENCODE), packed(NULL), packed_len(0), stamp(0) {}
+};
+
+map<size_t,Clip*> Clip::clip_map;
+size_t Clip::num_clips = 0;
+
+namespace spool {
+	string dir;
+	GThread *writer = NULL;
+	GAsyncQueue *jobs = NULL;
+	GAsyncQueue *done = NULL;
+	size_t in_flight = 0;
+	GThread *packer = NULL;
+	GAsyncQueue *pack_jobs = NULL;
+}
+
+/*
+ * Read-only blocks of silence that every silent block of every clip
+ * points at. Pages of the zero one are never even faulted in.
+ */
+namespace silence {
+	char *zero = NULL;
+	char *u8 = NULL;
+	float floor = 0.0f;
+}
+
+static gpointer spool_writer(gpointer) {
+	SpoolJob *job;
+	ssize_t n;
+	size_t pos;
+
+	for (;;) {
+		job = (SpoolJob *)g_async_queue_pop(spool::jobs);
+
+		for (pos = 0; pos < job->len; pos += n) {
+			n = pwrite(job->clip->fd, job->data+pos, job->len-pos, job->offset+pos);
+			if (n < 0) {
+				if (errno != EINTR) {
+					break;
+				}
+				n = 0;
+			}
+		}
+		job->ok = (pos == job->len);
+
+		g_async_queue_push(spool::done, job);
+	}
+	return NULL;
+}
+
+/* One per encoding clip, feeding its blocks to the encoder in order */
+static gpointer encode_worker(gpointer data) {
+	Clip *c = (Clip *)data;
+	SpoolJob *job;
+	bool last;
+
+	do {
+		job = (SpoolJob *)g_async_queue_pop(c->enc_jobs);
+		last = (job->data == NULL);
+
+		job->ok = last ? c->enc->close() : c->enc->write(job->data, job->len);
+
+		g_async_queue_push(spool::done, job);
+	} while (!last);
+
+	return NULL;
+}
+
+/* Compresses blocks of idle clips, one at a time in the background */
+static gpointer pack_worker(gpointer) {
+	SpoolJob *job;
+
+	for (;;) {
+		job = (SpoolJob *)g_async_queue_pop(spool::pack_jobs);
+
+		job->packed = pack_block(job->clip->spec, job->offset, job->data, job->len, &job->packed_len);
+		job->ok = (job->packed != NULL);
+
+		g_async_queue_push(spool::done, job);
+	}
+	return NULL;
+}
+
+/*
+ * Runs on the main loop: swaps a flushed block over to the file mapping,
+ * or releases one the encoder has taken or that has been packed.
+ */
+static void reap(SpoolJob *job) {
+	Clip *c = job->clip;
+
+	if (job->kind == JOB_PACK) {
+		if (job->ok) {
+			c->packed[job->blk] = job->packed;
+			c->packed_len[job->blk] = job->packed_len;
+			/* Touched or saved while packing, the block stays for whoever is using it */
+			if (c->touched == job->stamp && c->saving == 0) {
+				c->blocks[job->blk] = NULL;
+				pool_put(job->data);
+			}
+		}
+		c->pending--;
+		delete job;
+		return;
+	}
+
+	if (job->kind == JOB_ENCODE) {
+		if (job->ok && job->data != NULL) {
+			c->blocks[job->blk] = NULL;
+			pool_put(job->data);
+		}
+		c->enc_in_flight--;
+		c->pending--;
+		delete job;
+
+		if (!c->finished) {
+			c->encode(false);
+		}
+		return;
+	}
+
+	if (job->ok) {
+		c->blocks[job->blk] = c->map + job->offset;
+		pool_put(job->data);
+	} else {
+		fprintf(stderr, __FILE__": spool write failed, keeping block in memory\n");
+	}
+
+	c->pending--;
+	spool::in_flight--;
+	delete job;
+}
+
+static char *alloc_block() {
+	clip_reap();
+	return pool_get();
+}
+
+static bool shared(char *b) {
+	return b != NULL && (b == silence::zero || b == silence::u8);
+}
+
+/* Blocks from the pool, as opposed to pages of the backing file or shared silence */
+static bool pooled(Clip *c, char *b) {
+	return b != NULL && !shared(b) && (c->map == NULL || b < c->map || b >= c->map+MAP_RESERVE);
+}
+
+static char *silent_block(uint8_t fill) {
+	char **b = fill ? &silence::u8 : &silence::zero;
+	void *m;
+
+	if (*b == NULL) {
+		m = mmap(NULL, BLOCK_SIZE, fill ? PROT_READ | PROT_WRITE : PROT_READ,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m == MAP_FAILED) {
+			fprintf(stderr, __FILE__": can't map silent block: %s\n", strerror(errno));
+			return NULL;
+		}
+		if (fill) {
+			memset(m, fill, BLOCK_SIZE);
+			mprotect(m, BLOCK_SIZE, PROT_READ);
+		}
+		*b = (char *)m;
+	}
+	return *b;
+}
+
+/* An unlinked temporary file in the spool directory */
+static int open_tmpfile() {
+	const char *dir;
+	gchar *path;
+	int fd;
+
+	dir = spool::dir.empty() ? g_get_user_cache_dir() : spool::dir.c_str();
+	g_mkdir_with_parents(dir, 0700);
+
+	path = g_build_filename(dir, "soundrec-XXXXXX", NULL);
+	fd = g_mkstemp(path);
+
+	if (fd < 0) {
+		fprintf(stderr, __FILE__": can't create file %s: %s\n", path, strerror(errno));
+	} else {
+		/* Nobody else needs the name, the clip owns the descriptor */
+		g_unlink(path);
+	}
+	g_free(path);
+	return fd;
+}
+
+static void spool_queues() {
+	if (spool::done == NULL) {
+		spool::jobs = g_async_queue_new();
+		spool::done = g_async_queue_new();
+	}
+}
+
+static bool open_backing(Clip *c) {
+	void *m;
+	int prot = PROT_READ;
+
+	if (c->store == STORE_MAPPED) {
+		prot |= PROT_WRITE;
+		c->fd = memfd_create("soundrec", MFD_CLOEXEC);
+		if (c->fd < 0) {
+			c->fd = open_tmpfile();
+		}
+	} else {
+		c->fd = open_tmpfile();
+	}
+
+	if (c->fd < 0) {
+		return false;
+	}
+
+	/*
+	 * Map the whole reservation up front: pages past the end of the file
+	 * become usable as it grows, so block pointers never move.
+	 */
+	m = mmap(NULL, MAP_RESERVE, prot, MAP_SHARED | MAP_NORESERVE, c->fd, 0);
+	if (m == MAP_FAILED) {
+		fprintf(stderr, __FILE__": can't map backing file: %s\n", strerror(errno));
+		close(c->fd);
+		c->fd = -1;
+		return false;
+	}
+	c->map = (char *)m;
+
+	if (c->store == STORE_SPOOL && spool::writer == NULL) {
+		spool_queues();
+		spool::writer = g_thread_new("spool", spool_writer, NULL);
+	}
+	return true;
+}
+
+/*
+ * With a codec, raw blocks stay in memory only until encoded; the stream
+ * goes to a temporary file unless clips are kept in memory.
+ */
+static bool open_encoder(Clip *c, clip_codec codec) {
+	c->enc = new Encoder(codec, c->spec, c->store == STORE_MEMORY ? -1 : open_tmpfile());
+	if (!c->enc->open()) {
+		delete c->enc;
+		c->enc = NULL;
+		return false;
+	}
+
+	spool_queues();
+	c->enc_jobs = g_async_queue_new();
+	c->enc_thread = g_thread_new("encode", encode_worker, c);
+	return true;
+}
+
+Clip::Clip(clip_store s, const pa_sample_spec &ss, clip_codec codec) : capacity(0), rec_size(0),
+		spec(ss), k(dsp_kernels(&ss)), store(s), fd(-1), map(NULL), pending(0),
+		started(g_get_monotonic_time()), enc(NULL), enc_thread(NULL), enc_jobs(NULL),
+		enc_next(0), enc_in_flight(0), enc_warned(false), finished(false), touched(started), trim(NULL), saving(0),
+		meter(new Loudness(ss)) {
+	if (codec != CODEC_NONE && open_encoder(this, codec)) {
+		store = STORE_MEMORY;
+	}
+	if (store != STORE_MEMORY && !open_backing(this)) {
+		store = STORE_MEMORY;
+	}
+	this->expand();
+	id = num_clips++;
+	clip_map[id] = this;
+}
+
+/* Hands the last block to the writer thread, waiting if too many are queued */
+void Clip::spool(size_t len) {
+	SpoolJob *job;
+
+	while (spool::in_flight >= SPOOL_QUEUE) {
+		reap((SpoolJob *)g_async_queue_pop(spool::done));
+	}
+
+	job = new SpoolJob(this, blocks.size()-1, capacity-BLOCK_SIZE, len);
+	pending++;
+	spool::in_flight++;
+
+	g_async_queue_push(spool::jobs, job);
+}
+
+void Clip::queue_encode(size_t blk, size_t len) {
+	SpoolJob *job = new SpoolJob(this, blk, blk*BLOCK_SIZE, len);
+
+	job->kind = JOB_ENCODE;
+	pending++;
+	enc_in_flight++;
+	g_async_queue_push(enc_jobs, job);
+}
+
+/* Hands full blocks to the encoder, all of them and the rest of the clip if all */
+void Clip::encode(bool all) {
+	size_t full = rec_size/BLOCK_SIZE;
+
+	while (enc_next < full && (all || enc_in_flight < ENCODE_QUEUE)) {
+		queue_encode(enc_next, BLOCK_SIZE);
+		enc_next++;
+	}
+
+	if (all) {
+		if (enc_next*BLOCK_SIZE < rec_size) {
+			queue_encode(enc_next, rec_size - enc_next*BLOCK_SIZE);
+			enc_next++;
+		}
+		pending++;
+		enc_in_flight++;
+		g_async_queue_push(enc_jobs, new SpoolJob(this));
+		return;
+	}
+
+	/* Blocks wait in memory rather than hold up recording */
+	if (enc_next < full && !enc_warned) {
+		fprintf(stderr, __FILE__": encoder is behind, %zu bytes waiting\n", backlog());
+		enc_warned = true;
+	} else if (enc_next == full) {
+		enc_warned = false;
+	}
+}
+
+/* Bytes recorded but not encoded yet */
+size_t Clip::backlog() {
+	size_t done;
+
+	if (enc == NULL) {
+		return 0;
+	}
+	done = (enc_next - enc_in_flight)*BLOCK_SIZE;
+	return rec_size > done ? rec_size - done : 0;
+}
+
+/*
+ * Swaps a block nothing will write to again for the shared silent one if
+ * it holds nothing else. With a floor set, quiet blocks count as silent;
+ * only for sample sizes that never straddle blocks, so whole samples go.
+ */
+void Clip::dedup(size_t blk, size_t len) {
+	const uint8_t fill = (spec.format == PA_SAMPLE_U8) ? 0x80 : 0;
+	pa_sample_spec mono = spec;
+	char *b = blocks[blk], *s;
+	bool quiet;
+
+	mono.channels = 1;
+	quiet = dsp_is_fill(b, len, fill) || (silence::floor > 0.0f && BLOCK_SIZE%pa_sample_size(&spec) == 0 &&
+			dsp_kernels(&mono).peak(b, len/pa_sample_size(&spec), 1) <= silence::floor);
+
+	if (quiet && (s = silent_block(fill)) != NULL) {
+		blocks[blk] = s;
+		pool_put(b);
+	}
+}
+
+char* Clip::expand() {
+	if (enc != NULL) {
+		encode(false);
+		blocks.push_back(alloc_block());
+	} else if (store == STORE_SPOOL) {
+		if (!blocks.empty()) {
+			spool(BLOCK_SIZE);
+		}
+		blocks.push_back(alloc_block());
+	} else if (store == STORE_MAPPED && capacity+BLOCK_SIZE <= MAP_RESERVE &&
+			ftruncate(fd, capacity+BLOCK_SIZE) == 0) {
+		blocks.push_back(map+capacity);
+	} else {
+		if (store == STORE_MAPPED) {
+			fprintf(stderr, __FILE__": can't grow backing file, using heap\n");
+		} else if (!blocks.empty()) {
+			dedup(blocks.size()-1, BLOCK_SIZE);
+		}
+		blocks.push_back(pool_get());
+	}
+	capacity += BLOCK_SIZE;
+	return blocks.back();
+}
+
+/* Copies any amount of data in, crossing as many block boundaries as needed */
+void Clip::append(const char *data, size_t nbytes) {
+	size_t off, n;
+
+	meter->add(data, nbytes);
+
+	while (nbytes > 0) {
+		if (rec_size == capacity) {
+			expand();
+		}
+		off = rec_size%BLOCK_SIZE;
+		n = BLOCK_SIZE - off;
+		if (n > nbytes) {
+			n = nbytes;
+		}
+
+		memcpy(blocks[rec_size/BLOCK_SIZE] + off, data, n);
+		rec_size += n;
+		data += n;
+		nbytes -= n;
+	}
+}
+
+/*
+ * Takes a filled block from the pool as the clip's next one instead of
+ * copying it in. Only clips keeping pool blocks, with whole blocks so far,
+ * can; any other gets it appended and the block goes back to the pool.
+ */
+void Clip::adopt(char *block, size_t nbytes) {
+	if (rec_size%BLOCK_SIZE != 0 || enc != NULL || trim != NULL ||
+			(store != STORE_MEMORY && store != STORE_SPOOL)) {
+		append(block, nbytes);
+		pool_put(block);
+		return;
+	}
+
+	meter->add(block, nbytes);
+	if (rec_size < capacity) {
+		/* The empty block expand() had ready goes back instead */
+		pool_put(blocks.back());
+		blocks.back() = block;
+	} else {
+		if (store == STORE_SPOOL) {
+			spool(BLOCK_SIZE);
+		} else {
+			dedup(blocks.size()-1, BLOCK_SIZE);
+		}
+		blocks.push_back(block);
+		capacity += BLOCK_SIZE;
+	}
+	rec_size += nbytes;
+}
+
+/* Captured audio, which the trimmer may leave some of out */
+void Clip::record(const char *data, size_t nbytes) {
+	if (trim != NULL) {
+		trim->write(this, data, nbytes);
+	} else {
+		append(data, nbytes);
+	}
+}
+
+/* Recording has stopped: spool whatever is left in the last block */
+void Clip::finish() {
+	size_t tail;
+
+	if (trim != NULL) {
+		trim->flush(this);
+	}
+	tail = rec_size - (capacity-BLOCK_SIZE);
+
+	if (store == STORE_SPOOL && tail > 0) {
+		spool(tail);
+	}
+	if (enc != NULL) {
+		encode(true);
+	} else if (store == STORE_MEMORY && tail > 0) {
+		dedup(blocks.size()-1, tail);
+	}
+	finished = true;
+}
+
+/* Picks up flushed blocks; with wait, until none of ours are in flight */
+void Clip::sync(bool wait) {
+	SpoolJob *job;
+
+	if (store != STORE_SPOOL && enc == NULL && pending == 0) {
+		return;
+	}
+
+	while ((job = (SpoolJob *)g_async_queue_try_pop(spool::done)) != NULL) {
+		reap(job);
+	}
+
+	while (wait && pending > 0) {
+		reap((SpoolJob *)g_async_queue_pop(spool::done));
+	}
+}
+
+/*
+ * Decodes blocks the encoder released back into memory. Not possible
+ * until recording has finished; what can't be decoded becomes silence.
+ */
+bool Clip::decode() {
+	vector<char> skip;
+	size_t i, len, got;
+	bool ok;
+
+	if (enc == NULL) {
+		return true;
+	}
+	if (!finished) {
+		return false;
+	}
+	sync(true);
+
+	for (i = 0; i < blocks.size() && blocks[i] != NULL; i++);
+	if (i == blocks.size()) {
+		return true;
+	}
+
+	ok = enc->ok && enc->rewind();
+
+	for (i = 0; i*BLOCK_SIZE < rec_size; i++) {
+		len = rec_size - i*BLOCK_SIZE;
+		len = len < BLOCK_SIZE ? len : BLOCK_SIZE;
+
+		if (blocks[i] != NULL) {
+			/* Kept because encoding failed, the stream has it too if at all */
+			skip.resize(len);
+			ok = ok && enc->read(&skip[0], len) == len;
+			continue;
+		}
+
+		blocks[i] = pool_get();
+		got = ok ? enc->read(blocks[i], len) : 0;
+		if (got < len) {
+			memset(blocks[i] + got, spec.format == PA_SAMPLE_U8 ? 0x80 : 0, len - got);
+			ok = false;
+		}
+	}
+
+	if (!ok) {
+		fprintf(stderr, __FILE__": clip %zu could not be fully decoded\n", id);
+	}
+	return true;
+}
+
+/*
+ * Brings the blocks covering a range back into memory, where they stay
+ * until the clip is left alone again. Encoded clips come back whole.
+ */
+bool Clip::load(size_t off, size_t len) {
+	size_t i, end, n;
+
+	touched = g_get_monotonic_time();
+	if (enc != NULL) {
+		return decode();
+	}
+
+	end = (len > rec_size || off+len > rec_size) ? rec_size : off+len;
+
+	for (i = off/BLOCK_SIZE; i*BLOCK_SIZE < end; i++) {
+		if (blocks[i] != NULL) {
+			continue;
+		}
+		n = rec_size - i*BLOCK_SIZE;
+		n = n < BLOCK_SIZE ? n : BLOCK_SIZE;
+
+		blocks[i] = pool_get();
+		if (!unpack_block(spec, i*BLOCK_SIZE, packed[i], packed_len[i], blocks[i], n)) {
+			fprintf(stderr, __FILE__": block %zu of clip %zu is damaged\n", i, id);
+			memset(blocks[i], spec.format == PA_SAMPLE_U8 ? 0x80 : 0, n);
+		}
+	}
+	return true;
+}
+
+/*
+ * For a clip left unused for a while: blocks with a packed copy are let
+ * go, the rest are handed to the packer thread and let go once packed.
+ * An encoded clip drops what was decoded, the stream still has it.
+ */
+void Clip::pack() {
+	SpoolJob *job;
+	size_t i, n;
+
+	if (!finished || store != STORE_MEMORY || pending > 0 || saving > 0 || (enc != NULL && !enc->ok)) {
+		return;
+	}
+
+	if (spool::packer == NULL) {
+		spool_queues();
+		spool::pack_jobs = g_async_queue_new();
+		spool::packer = g_thread_new("pack", pack_worker, NULL);
+	}
+	packed.resize(blocks.size(), NULL);
+	packed_len.resize(blocks.size(), 0);
+
+	for (i = 0; i*BLOCK_SIZE < rec_size; i++) {
+		if (blocks[i] == NULL || shared(blocks[i])) {
+			continue;
+		}
+		if (enc != NULL || packed[i] != NULL) {
+			pool_put(blocks[i]);
+			blocks[i] = NULL;
+			continue;
+		}
+		n = rec_size - i*BLOCK_SIZE;
+		n = n < BLOCK_SIZE ? n : BLOCK_SIZE;
+
+		job = new SpoolJob(this, i, i*BLOCK_SIZE, n);
+		job->kind = JOB_PACK;
+		job->stamp = touched;
+		pending++;
+		g_async_queue_push(spool::pack_jobs, job);
+	}
+}
+
+/* Memory holding the clip's audio: blocks from the pool, packed copies, the encoded stream */
+size_t Clip::memory() {
+	size_t i, total = 0;
+
+	for (i = 0; i < blocks.size(); i++) {
+		if (pooled(this, blocks[i])) {
+			total += BLOCK_SIZE;
+		}
+	}
+	for (i = 0; i < packed.size(); i++) {
+		if (packed[i] != NULL) {
+			total += packed_len[i];
+		}
+	}
+	if (enc != NULL && enc->fd < 0) {
+		total += enc->size.load();
+	}
+	return total;
+}
+
+/* Whether the backing file holds the whole clip in order */
+bool Clip::contiguous() {
+	size_t i;
+
+	if (store == STORE_MEMORY) {
+		return false;
+	}
+	for (i = 0; i*BLOCK_SIZE < rec_size; i++) {
+		if (blocks[i] != map+(i*BLOCK_SIZE)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+Clip::~Clip() {
+	size_t i;
+
+	if (enc != NULL && !finished) {
+		encode(true);
+	}
+	sync(true);
+	clip_map.erase(id);
+
+	if (enc != NULL) {
+		g_thread_join(enc_thread);
+		g_async_queue_unref(enc_jobs);
+		delete enc;
+	}
+	delete trim;
+	delete meter;
+
+	for (i = 0; i < blocks.size(); i++) {
+		if (pooled(this, blocks[i])) {
+			pool_put(blocks[i]);
+		}
+	}
+	for (i = 0; i < packed.size(); i++) {
+		free(packed[i]);
+	}
+
+	if (map != NULL) {
+		munmap(map, MAP_RESERVE);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+/* Contiguous run of at most max bytes at the cursor, which moves past it */
+size_t Cursor::next(const char **data, size_t max) {
+	size_t n;
+
+	if (pos >= clip->rec_size) {
+		return 0;
+	}
+
+	n = BLOCK_SIZE - (pos%BLOCK_SIZE);
+	if (n > clip->rec_size - pos) {
+		n = clip->rec_size - pos;
+	}
+	if (n > max) {
+		n = max;
+	}
+
+	*data = clip->at(pos);
+	pos += n;
+	return n;
+}
+
+void clip_set_spool_dir(const char *dir) {
+	spool::dir = (dir != NULL) ? dir : "";
+}
+
+/* Peak level, 0 to 1, at or below which a block is kept as silence; 0 for digital silence only */
+void clip_set_silence_floor(float level) {
+	silence::floor = level;
+}
+
+/* Picks up whatever the background threads have finished, for every clip */
+void clip_reap() {
+	SpoolJob *job;
+
+	if (spool::done == NULL) {
+		return;
+	}
+	while ((job = (SpoolJob *)g_async_queue_try_pop(spool::done)) != NULL) {
+		reap(job);
+	}
+}
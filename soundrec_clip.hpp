@@ -0,0 +1,90 @@
+#ifndef _SOUNDREC_CLIP_HEADER_
+#define _SOUNDREC_CLIP_HEADER_
+
+#include <map>
+#include <vector>
+#include <cstddef>
+
+#include <glib.h>
+
+#include "soundrec.hpp"
+#include "soundrec_dsp.hpp"
+#include "soundrec_enc.hpp"
+#include "soundrec_trim.hpp"
+#include "soundrec_loudness.hpp"
+
+#define BLOCK_SIZE (1024*1024)
+
+class Clip {
+	private:
+		static size_t num_clips;
+		void spool(size_t len);
+		void queue_encode(size_t blk, size_t len);
+		bool decode();
+		void dedup(size_t blk, size_t len);
+	public:
+		std::vector<char *> blocks;
+		size_t capacity;
+		size_t rec_size;
+		size_t id;
+		pa_sample_spec spec;
+		Kernels k;
+		clip_store store;
+		int fd;
+		char *map;
+		size_t pending;
+		/* Monotonic time the clip was created, in microseconds */
+		int64_t started;
+		/* With a codec, blocks are released (NULL) once encoded */
+		Encoder *enc;
+		GThread *enc_thread;
+		GAsyncQueue *enc_jobs;
+		size_t enc_next;
+		size_t enc_in_flight;
+		bool enc_warned;
+		bool finished;
+		/* Compressed copies of blocks, kept once made; a block may then be NULL */
+		std::vector<char *> packed;
+		std::vector<size_t> packed_len;
+		/* Last time the clip's blocks were asked for */
+		int64_t touched;
+		/* Leaves long quiet stretches out of what is recorded, if set */
+		Trimmer *trim;
+		/* Saves reading the blocks; none are let go while there are any */
+		size_t saving;
+		/* Loudness of everything appended so far */
+		Loudness *meter;
+		static std::map<size_t,Clip*> clip_map;
+		Clip(clip_store s, const pa_sample_spec &ss, clip_codec codec = CODEC_NONE);
+		char* expand();
+		char* at(size_t off) {
+			return blocks[off/BLOCK_SIZE] + (off%BLOCK_SIZE);
+		}
+		void append(const char *data, size_t nbytes);
+		void adopt(char *block, size_t nbytes);
+		void record(const char *data, size_t nbytes);
+		void finish();
+		void sync(bool wait);
+		void encode(bool all);
+		size_t backlog();
+		bool load(size_t off = 0, size_t len = (size_t)-1);
+		void pack();
+		size_t memory();
+		bool contiguous();
+		~Clip();
+};
+
+/* A read position of its own, so any number of readers can share a clip */
+class Cursor {
+	public:
+		Clip *clip;
+		size_t pos;
+		Cursor(Clip *c, size_t p) : clip(c), pos(p) {}
+		size_t next(const char **data, size_t max);
+};
+
+void clip_set_spool_dir(const char *dir);
+void clip_reap();
+void clip_set_silence_floor(float level);
+
+#endif
@@ -0,0 +1,295 @@
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <glib.h>
+
+#include <pulse/pulseaudio.h>
+
+#include "soundrec.hpp"
+
+using namespace std;
+
+static void load_trim(GKeyFile *kf) {
+	double db, hang = 2.0, pad = 0.25;
+	
+	db = g_key_file_get_double(kf, "Record", "TrimBelow", NULL);
+	if (g_key_file_has_key(kf, "Record", "TrimHangover", NULL)) {
+		hang = g_key_file_get_double(kf, "Record", "TrimHangover", NULL);
+	}
+	if (g_key_file_has_key(kf, "Record", "TrimPad", NULL)) {
+		pad = g_key_file_get_double(kf, "Record", "TrimPad", NULL);
+	}
+	if (db >= 0.0 || hang < 0.0 || pad < 0.0) {
+		fprintf(stderr, "bad Trim settings\n");
+		return;
+	}
+	soundrec_set_trim(pow(10.0, db/20.0), hang, pad);
+}
+
+static void load_record(GKeyFile *kf) {
+	gchar *str;
+	double db;
+	
+	str = g_key_file_get_string(kf, "Record", "Storage", NULL);
+	if (str != NULL) {
+		if (strcmp(str, "spool") == 0) {
+			soundrec_set_store(STORE_SPOOL);
+		} else if (strcmp(str, "mapped") == 0) {
+			soundrec_set_store(STORE_MAPPED);
+		} else if (strcmp(str, "memory") == 0) {
+			soundrec_set_store(STORE_MEMORY);
+		} else {
+			fprintf(stderr, "unknown Storage: %s\n", str);
+		}
+		g_free(str);
+	}
+	
+	str = g_key_file_get_string(kf, "Record", "SpoolDir", NULL);
+	if (str != NULL) {
+		soundrec_set_spool_dir(str);
+		g_free(str);
+	}
+	
+	str = g_key_file_get_string(kf, "Record", "Encode", NULL);
+	if (str != NULL) {
+		if (strcmp(str, "flac") == 0) {
+			soundrec_set_codec(CODEC_FLAC);
+		} else if (strcmp(str, "opus") == 0) {
+			soundrec_set_codec(CODEC_OPUS);
+		} else if (strcmp(str, "vorbis") == 0) {
+			soundrec_set_codec(CODEC_VORBIS);
+		} else if (strcmp(str, "none") == 0) {
+			soundrec_set_codec(CODEC_NONE);
+		} else {
+			fprintf(stderr, "unknown Encode: %s\n", str);
+		}
+		g_free(str);
+	}
+	
+	if (g_key_file_has_key(kf, "Record", "SilenceFloor", NULL)) {
+		db = g_key_file_get_double(kf, "Record", "SilenceFloor", NULL);
+		if (db < 0.0) {
+			soundrec_set_silence_floor(pow(10.0, db/20.0));
+		} else {
+			fprintf(stderr, "bad SilenceFloor: %g\n", db);
+		}
+	}
+	
+	if (g_key_file_has_key(kf, "Record", "TrimBelow", NULL)) {
+		load_trim(kf);
+	}
+	
+	if (g_key_file_has_key(kf, "Record", "Multitrack", NULL)) {
+		soundrec_set_multitrack(g_key_file_get_boolean(kf, "Record", "Multitrack", NULL));
+	}
+}
+
+static void load_format(GKeyFile *kf) {
+	pa_sample_spec ss = { PA_SAMPLE_S16LE, 44100, 2 };
+	gchar *str;
+	
+	str = g_key_file_get_string(kf, "Record", "Format", NULL);
+	if (str != NULL && strcmp(str, "native") == 0) {
+		soundrec_set_sample_spec(NULL);
+		g_free(str);
+		return;
+	}
+	
+	if (str != NULL) {
+		ss.format = pa_parse_sample_format(str);
+		g_free(str);
+	}
+	if (g_key_file_has_key(kf, "Record", "Rate", NULL)) {
+		ss.rate = g_key_file_get_integer(kf, "Record", "Rate", NULL);
+	}
+	if (g_key_file_has_key(kf, "Record", "Channels", NULL)) {
+		ss.channels = g_key_file_get_integer(kf, "Record", "Channels", NULL);
+	}
+	
+	if (pa_sample_spec_valid(&ss)) {
+		soundrec_set_sample_spec(&ss);
+	} else {
+		fprintf(stderr, "bad sample format in [Record]\n");
+	}
+}
+
+static void load_latency(GKeyFile *kf, const char *group, bool record) {
+	latency_profile p;
+	gchar *str;
+	
+	str = g_key_file_get_string(kf, group, "Latency", NULL);
+	if (str != NULL) {
+		if (soundrec_parse_latency(str, &p)) {
+			soundrec_set_latency(record, p);
+		} else {
+			fprintf(stderr, "unknown Latency: %s\n", str);
+		}
+		g_free(str);
+	}
+}
+
+static void load_trigger(GKeyFile *kf) {
+	double db = -40.0, preroll = 2.0, hold = 5.0;
+	
+	if (g_key_file_has_key(kf, "Trigger", "Level", NULL)) {
+		db = g_key_file_get_double(kf, "Trigger", "Level", NULL);
+	}
+	if (g_key_file_has_key(kf, "Trigger", "PreRoll", NULL)) {
+		preroll = g_key_file_get_double(kf, "Trigger", "PreRoll", NULL);
+	}
+	if (g_key_file_has_key(kf, "Trigger", "Hold", NULL)) {
+		hold = g_key_file_get_double(kf, "Trigger", "Hold", NULL);
+	}
+	if (db > 0.0 || preroll < 0.0 || hold < 0.0) {
+		fprintf(stderr, "bad Trigger settings\n");
+		return;
+	}
+	soundrec_set_trigger(pow(10.0, db/20.0), preroll, hold);
+}
+
+static void load_replay(GKeyFile *kf) {
+	double seconds;
+	
+	if (!g_key_file_has_key(kf, "Replay", "Seconds", NULL)) {
+		return;
+	}
+	seconds = g_key_file_get_double(kf, "Replay", "Seconds", NULL);
+	if (seconds < 0.0) {
+		fprintf(stderr, "bad Replay Seconds: %g\n", seconds);
+		return;
+	}
+	soundrec_set_replay(seconds);
+}
+
+static void load_rotate(GKeyFile *kf) {
+	double minutes = 60.0, mbytes = 0.0;
+	gchar *dir, *prefix;
+	
+	if (g_key_file_has_key(kf, "Rotate", "Minutes", NULL)) {
+		minutes = g_key_file_get_double(kf, "Rotate", "Minutes", NULL);
+	}
+	if (g_key_file_has_key(kf, "Rotate", "MegaBytes", NULL)) {
+		mbytes = g_key_file_get_double(kf, "Rotate", "MegaBytes", NULL);
+	}
+	if (minutes < 0.0 || mbytes < 0.0) {
+		fprintf(stderr, "bad Rotate limits\n");
+		return;
+	}
+	
+	dir = g_key_file_get_string(kf, "Rotate", "Path", NULL);
+	prefix = g_key_file_get_string(kf, "Rotate", "Prefix", NULL);
+	soundrec_set_rotate(dir, prefix, minutes, mbytes);
+	g_free(dir);
+	g_free(prefix);
+}
+
+static void load_save(GKeyFile *kf) {
+	gint writers;
+	
+	if (!g_key_file_has_key(kf, "Save", "Writers", NULL)) {
+		return;
+	}
+	writers = g_key_file_get_integer(kf, "Save", "Writers", NULL);
+	if (writers < 1) {
+		fprintf(stderr, "bad Save Writers: %d\n", writers);
+		return;
+	}
+	soundrec_set_save_writers(writers);
+}
+
+static void load_export(GKeyFile *kf) {
+	pa_sample_spec ss = { PA_SAMPLE_INVALID, 0, 0 };
+	gboolean dither = TRUE;
+	gchar *str;
+	gint rate = 0, channels = 0;
+	double target = -23.0, peak = -1.0;
+	
+	str = g_key_file_get_string(kf, "Export", "Format", NULL);
+	if (str != NULL && strcmp(str, "keep") != 0) {
+		ss.format = pa_parse_sample_format(str);
+		if (ss.format == PA_SAMPLE_INVALID) {
+			fprintf(stderr, "unknown Export Format: %s\n", str);
+		}
+	}
+	g_free(str);
+	
+	if (g_key_file_has_key(kf, "Export", "Rate", NULL)) {
+		rate = g_key_file_get_integer(kf, "Export", "Rate", NULL);
+	}
+	if (g_key_file_has_key(kf, "Export", "Channels", NULL)) {
+		channels = g_key_file_get_integer(kf, "Export", "Channels", NULL);
+	}
+	if (g_key_file_has_key(kf, "Export", "Dither", NULL)) {
+		dither = g_key_file_get_boolean(kf, "Export", "Dither", NULL);
+	}
+	if (rate < 0 || rate > (gint)PA_RATE_MAX || channels < 0 || channels > (gint)PA_CHANNELS_MAX) {
+		fprintf(stderr, "bad Export Rate or Channels\n");
+		return;
+	}
+	
+	ss.rate = rate;
+	ss.channels = channels;
+	soundrec_set_export(&ss, dither);
+	
+	if (g_key_file_has_key(kf, "Export", "Loudness", NULL)) {
+		target = g_key_file_get_double(kf, "Export", "Loudness", NULL);
+	}
+	if (g_key_file_has_key(kf, "Export", "TruePeak", NULL)) {
+		peak = g_key_file_get_double(kf, "Export", "TruePeak", NULL);
+	}
+	if (target >= 0.0 || peak > 0.0) {
+		fprintf(stderr, "bad Export Loudness or TruePeak\n");
+		return;
+	}
+	soundrec_set_loudness(target, peak);
+}
+
+static void load_pool(GKeyFile *kf) {
+	gint prealloc = 2, high_water = 16, idle;
+	
+	if (g_key_file_has_key(kf, "Pool", "PackIdle", NULL)) {
+		idle = g_key_file_get_integer(kf, "Pool", "PackIdle", NULL);
+		if (idle >= 0) {
+			soundrec_set_pack_idle(idle);
+		} else {
+			fprintf(stderr, "bad PackIdle: %d\n", idle);
+		}
+	}
+	
+	if (g_key_file_has_key(kf, "Pool", "Prealloc", NULL)) {
+		prealloc = g_key_file_get_integer(kf, "Pool", "Prealloc", NULL);
+	}
+	if (g_key_file_has_key(kf, "Pool", "HighWater", NULL)) {
+		high_water = g_key_file_get_integer(kf, "Pool", "HighWater", NULL);
+	}
+	if (prealloc < 0 || high_water < 0) {
+		fprintf(stderr, "bad Pool limits\n");
+		return;
+	}
+	soundrec_set_pool(prealloc, high_water);
+}
+
+void soundrec_load_config(const char *fname) {
+	GKeyFile *kf = g_key_file_new();
+	GError *err = NULL;
+	
+	if (g_key_file_load_from_file(kf, fname, G_KEY_FILE_NONE, &err)) {
+		load_record(kf);
+		load_format(kf);
+		load_latency(kf, "Record", true);
+		load_latency(kf, "Playback", false);
+		load_pool(kf);
+		load_trigger(kf);
+		load_replay(kf);
+		load_rotate(kf);
+		load_save(kf);
+		load_export(kf);
+	} else {
+		fprintf(stderr, "%s\n", err->message);
+		g_error_free(err);
+	}
+	
+	g_key_file_free(kf);
+}
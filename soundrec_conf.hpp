@@ -0,0 +1,6 @@
+#ifndef _SOUNDREC_CONF_HEADER_
+#define _SOUNDREC_CONF_HEADER_
+
+void soundrec_load_config(const char *fname);
+
+#endif
@@ -0,0 +1,184 @@
+
+#include <cmath>
+
+#include "soundrec_convert.hpp"
+
+using namespace std;
+
+/* Phases of the filter worked out in advance, at most */
+#define CONVERT_PHASES 512
+/* Zero crossings of the sinc on each side of its peak */
+#define CONVERT_ZEROS 16
+/* Output frames converted at a time */
+#define CONVERT_CHUNK 4096
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+	uint64_t t;
+	
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double sinc(double x) {
+	return x == 0.0 ? 1.0 : sin(M_PI*x)/(M_PI*x);
+}
+
+Converter::Converter(const pa_sample_spec &i, const pa_sample_spec &o, bool dither, float g) : taps(0), phases(0),
+		kin(dsp_kernels(&i)), kout(dsp_kernels(&o)), lsb(0.0f), gain(g), in(i), out(o) {
+	const uint64_t common = gcd(i.rate, o.rate);
+	double scale, fc, d, u, w, sum;
+	size_t p, k;
+	float *row;
+	
+	l = o.rate/common;
+	m = i.rate/common;
+	
+	if (dither) {
+		switch (o.format) {
+			case PA_SAMPLE_U8:
+				lsb = 1.0f/128;
+				break;
+			case PA_SAMPLE_S16LE:
+				lsb = 1.0f/32768;
+				break;
+			case PA_SAMPLE_S24LE:
+				lsb = 1.0f/8388608;
+				break;
+			default:
+				break;
+		}
+	}
+	
+	if (l == m) {
+		return;
+	}
+	
+	/* Going down, the cutoff comes down with the output's Nyquist frequency */
+	scale = l < m ? (double)l/m : 1.0;
+	fc = 0.91*scale;
+	taps = (2*(size_t)ceil(CONVERT_ZEROS/fc) + 7) & ~(size_t)7;
+	phases = l < CONVERT_PHASES ? l : CONVERT_PHASES;
+	
+	/* Row p is for outputs p/phases of an input frame past the one they follow */
+	table.resize((phases+1)*taps);
+	for (p = 0; p <= phases; p++) {
+		row = &table[p*taps];
+		sum = 0.0;
+		for (k = 0; k < taps; k++) {
+			d = (double)p/phases + taps/2 - 1 - k;
+			u = d/(taps/2);
+			w = fabs(u) >= 1.0 ? 0.0 : 0.42 + 0.5*cos(M_PI*u) + 0.08*cos(2*M_PI*u);
+			row[k] = fc*sinc(fc*d)*w;
+			sum += row[k];
+		}
+		/* The same gain at DC, whatever the phase */
+		for (k = 0; k < taps; k++) {
+			row[k] *= gain/sum;
+		}
+	}
+}
+
+/* Output length for in_frames of input */
+uint64_t Converter::frames(uint64_t in_frames) {
+	return in_frames*l/m;
+}
+
+/* The input frame an output frame falls on or just after */
+uint64_t Converter::input_at(uint64_t out_frame) {
+	return out_frame*m/l;
+}
+
+/* n outputs from first on into every stride-th of y; x starts taps/2-1 frames before input_at(first) */
+void Converter::filter(const float *x, uint64_t first, size_t n, float *y, size_t stride) {
+	const uint64_t base = input_at(first);
+	uint64_t pos, r, ph;
+	const float *src;
+	float a, b;
+	size_t j;
+	
+	for (j = 0; j < n; j++) {
+		pos = (first+j)*m;
+		r = pos % l;
+		src = x + (pos/l - base);
+		if (phases == l) {
+			y[j*stride] = dsp_dot(&table[r*taps], src, taps);
+		} else {
+			ph = r*phases;
+			a = dsp_dot(&table[(ph/l)*taps], src, taps);
+			b = dsp_dot(&table[(ph/l + 1)*taps], src, taps);
+			y[j*stride] = a + (float)(ph % l)/l*(b - a);
+		}
+	}
+}
+
+/* Output frames first to first+n into dst, reading what they need of the input */
+void Converter::run(convert_read read, void *ctx, uint64_t first, size_t n, char *dst) {
+	const unsigned ich = in.channels, och = out.channels;
+	vector<char> raw;
+	vector<float> x, mono, y;
+	size_t done, c, count, i;
+	int64_t from;
+	unsigned oc, ic, k;
+	uint64_t h;
+	
+	for (done = 0; done < n; done += c) {
+		c = n - done < CONVERT_CHUNK ? n - done : CONVERT_CHUNK;
+		if (taps == 0) {
+			from = first + done;
+			count = c;
+		} else {
+			from = (int64_t)input_at(first + done) - (int64_t)(taps/2) + 1;
+			count = input_at(first + done + c - 1) - input_at(first + done) + taps;
+		}
+		
+		raw.resize(count*kin.frame);
+		read(ctx, from, count, &raw[0]);
+		x.resize(count*ich);
+		kin.to_float(&raw[0], &x[0], count, ich);
+		
+		mono.resize(count);
+		y.resize(c*och);
+		for (oc = 0; oc < och; oc++) {
+			if (och == 1) {
+				dsp_downmix(&x[0], &mono[0], count, ich);
+			} else if (och >= ich) {
+				for (i = 0, ic = oc % ich; i < count; i++) {
+					mono[i] = x[i*ich + ic];
+				}
+			} else {
+				k = (ich - oc + och - 1)/och;
+				for (i = 0; i < count; i++) {
+					mono[i] = 0.0f;
+					for (ic = oc; ic < ich; ic += och) {
+						mono[i] += x[i*ich + ic];
+					}
+					mono[i] /= k;
+				}
+			}
+			
+			if (taps == 0) {
+				for (i = 0; i < c; i++) {
+					y[i*och + oc] = gain*mono[i];
+				}
+			} else {
+				filter(&mono[0], first + done, c, &y[oc], och);
+			}
+		}
+		
+		/* Triangular dither of one LSB, hashed from the sample's position so pieces agree */
+		if (lsb > 0.0f) {
+			for (i = 0; i < c*och; i++) {
+				h = ((first + done)*och + i)*0x9e3779b97f4a7c15ull;
+				h = (h ^ (h >> 32))*0xd6e8feb86659fd93ull;
+				h ^= h >> 32;
+				y[i] += lsb*((int32_t)(h & 0xffffff) - (int32_t)((h >> 32) & 0xffffff))*(1.0f/16777216);
+			}
+		}
+		
+		kout.from_float(&y[0], dst + done*kout.frame, c, och);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef _SOUNDREC_CONVERT_HEADER_
+#define _SOUNDREC_CONVERT_HEADER_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <pulse/sample.h>
+
+#include "soundrec_dsp.hpp"
+
+/* Fills dst with count frames of the source from frame from on, silence outside it */
+typedef void (*convert_read)(void *ctx, int64_t from, size_t count, char *dst);
+
+/*
+ * Sample format, channel and rate conversion for export. Any stretch of
+ * the output can be made on its own from the source around it, so a clip
+ * can be converted in pieces on any number of threads at once.
+ *
+ * Fewer channels average the source channels c, c+n, c+2n... into channel
+ * c; more repeat them in turn. The rate is changed by a polyphase
+ * windowed sinc filter, exact for up to CONVERT_PHASES phases and
+ * interpolated between them above that. A gain can be applied too, at
+ * no extra cost.
+ */
+class Converter {
+	private:
+		/* Rate ratio out/in as l/m in lowest terms */
+		uint64_t l;
+		uint64_t m;
+		/* Filter taps, and phases of them in the table */
+		size_t taps;
+		size_t phases;
+		std::vector<float> table;
+		Kernels kin;
+		Kernels kout;
+		/* One LSB of the output format, 0 for no dither */
+		float lsb;
+		/* Applied on the way, folded into the filter when there is one */
+		float gain;
+		void filter(const float *x, uint64_t first, size_t n, float *y, size_t stride);
+	public:
+		pa_sample_spec in;
+		pa_sample_spec out;
+		Converter(const pa_sample_spec &i, const pa_sample_spec &o, bool dither, float g = 1.0f);
+		uint64_t frames(uint64_t in_frames);
+		uint64_t input_at(uint64_t out_frame);
+		void run(convert_read read, void *ctx, uint64_t first, size_t n, char *dst);
+};
+
+#endif
@@ -17,6 +17,39 @@ static GCallback switch_to_mic = NULL;
 static size_t owner_id;
 static GDBusConnection *connection = NULL;
 
+/* stream is "record" or "playback" */
+static void handle_latency(const gchar *mname, GVariant *param, GDBusMethodInvocation *inv) {
+	const gchar *stream, *name;
+	latency_profile p;
+	bool record;
+	
+	if (strcmp(mname, "SetLatency") == 0) {
+		g_variant_get(param, "(&s&s)", &stream, &name);
+	} else {
+		g_variant_get(param, "(&s)", &stream);
+		name = NULL;
+	}
+	
+	if (strcmp(stream, "record") != 0 && strcmp(stream, "playback") != 0) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR, 
+			G_DBUS_ERROR_INVALID_ARGS, "unknown stream: %s", stream);
+		return;
+	}
+	record = (strcmp(stream, "record") == 0);
+	
+	if (name == NULL) {
+		p = soundrec_get_latency(record);
+		g_dbus_method_invocation_return_value(inv, g_variant_new("(st)", 
+			soundrec_latency_name(p), (guint64)soundrec_get_latency_usec(record)));
+	} else if (soundrec_parse_latency(name, &p)) {
+		soundrec_set_latency(record, p);
+		g_dbus_method_invocation_return_value(inv, NULL);
+	} else {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR, 
+			G_DBUS_ERROR_INVALID_ARGS, "unknown profile: %s", name);
+	}
+}
+
 static void handle_method_call(GDBusConnection *con, 
 		const gchar *sender, 
 		const gchar *path, 
@@ -24,22 +57,23 @@ static void handle_method_call(GDBusConnection *con,
 		const gchar *mname,
 		GVariant *param, GDBusMethodInvocation *inv, gpointer user_data) 
 {
-	rec_state state = soundrec_get_state();
+	bool recording = soundrec_is_recording();
+	bool playing = soundrec_is_playing();
 	
 	if (strcmp(mname, "Record") == 0) {
-		if (record != NULL && state == IDLE) {
+		if (record != NULL && !recording) {
 			record();
 		}
 	} else if (strcmp(mname, "StopRecord") == 0) {
-		if (record != NULL && state == RECORDING) {
+		if (record != NULL && recording) {
 			record();
 		}
 	} else if (strcmp(mname, "Playback") == 0) {
-		if (playback != NULL && state == IDLE) {
+		if (playback != NULL && !playing) {
 			playback();
 		}
 	} else if (strcmp(mname, "StopPlayback") == 0) {
-		if (playback != NULL && state == PLAYING_BACK) {
+		if (playback != NULL && playing) {
 			playback();
 		}
 	} else if (strcmp(mname, "SwitchToSoundCard") == 0) {
@@ -50,6 +84,9 @@ static void handle_method_call(GDBusConnection *con,
 		if (switch_to_mic != NULL) {
 			switch_to_mic();
 		}
+	} else if (strcmp(mname, "SetLatency") == 0 || strcmp(mname, "GetLatency") == 0) {
+		handle_latency(mname, param, inv);
+		return;
 	} else {
 		printf("got unknown method: %s\n", mname);
 	}
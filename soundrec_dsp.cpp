@@ -0,0 +1,505 @@
+
+#include "soundrec_dsp.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DSP_X86
+#endif
+
+using namespace dsp;
+
+template <class F, unsigned C>
+static Kernels make_kernels(unsigned nch) {
+	Kernels k;
+	
+	k.frame = Frame<F,C>::size(nch);
+	k.channels = nch;
+	k.peak = peak<F,C>;
+	k.energy = energy<F,C>;
+	k.to_float = to_float<F,C>;
+	k.from_float = from_float<F,C>;
+	
+	return k;
+}
+
+template <class F>
+static Kernels select_channels(unsigned nch) {
+	switch (nch) {
+		case 1:
+			return make_kernels<F,1>(nch);
+		case 2:
+			return make_kernels<F,2>(nch);
+		default:
+			return make_kernels<F,0>(nch);
+	}
+}
+
+Kernels dsp_kernels(const pa_sample_spec *spec) {
+	switch (spec->format) {
+		case PA_SAMPLE_U8:
+			return select_channels<U8>(spec->channels);
+		case PA_SAMPLE_S24LE:
+			return select_channels<S24>(spec->channels);
+		case PA_SAMPLE_S32LE:
+			return select_channels<S32>(spec->channels);
+		case PA_SAMPLE_FLOAT32LE:
+			return select_channels<F32>(spec->channels);
+		default:
+			return select_channels<S16>(spec->channels);
+	}
+}
+
+/* dst += gain*src */
+static void mix_scalar(float *dst, const float *src, size_t n, float gain) {
+	for (size_t i = 0; i < n; i++) {
+		dst[i] += gain*src[i];
+	}
+}
+
+/* Mono src into both channels of stereo dst */
+static void mix_mono_scalar(float *dst, const float *src, size_t frames, float gain) {
+	for (size_t i = 0; i < frames; i++) {
+		dst[2*i] += gain*src[i];
+		dst[2*i+1] += gain*src[i];
+	}
+}
+
+static void saturate_scalar(float *buf, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		buf[i] = buf[i] > 1.0f ? 1.0f : (buf[i] < -1.0f ? -1.0f : buf[i]);
+	}
+}
+
+/* Floats are summed this far at most before going into the double */
+#define ENERGY_RUN 4096
+
+static double energy_scalar(const float *buf, size_t n) {
+	double sum = 0.0;
+	float acc;
+	size_t i, j;
+	
+	for (i = 0; i < n; i += ENERGY_RUN) {
+		acc = 0.0f;
+		for (j = i; j < n && j < i+ENERGY_RUN; j++) {
+			acc += buf[j]*buf[j];
+		}
+		sum += acc;
+	}
+	return sum;
+}
+
+static float dot_scalar(const float *a, const float *b, size_t n) {
+	float acc = 0.0f;
+	
+	for (size_t i = 0; i < n; i++) {
+		acc += a[i]*b[i];
+	}
+	return acc;
+}
+
+/* Largest |y[i]| for y[i] the sum of taps[j]*x[i+j] */
+static float fir_peak_scalar(const float *x, const float *taps, size_t ntaps, size_t n) {
+	float pk = 0.0f, acc;
+	
+	for (size_t i = 0; i < n; i++) {
+		acc = 0.0f;
+		for (size_t j = 0; j < ntaps; j++) {
+			acc += taps[j]*x[i+j];
+		}
+		acc = acc < 0 ? -acc : acc;
+		pk = acc > pk ? acc : pk;
+	}
+	return pk;
+}
+
+/* Average of the channels of each frame */
+static void downmix_scalar(const float *src, float *dst, size_t frames, unsigned nch) {
+	const float g = 1.0f/nch;
+	float acc;
+	
+	for (size_t i = 0; i < frames; i++) {
+		acc = 0.0f;
+		for (unsigned c = 0; c < nch; c++) {
+			acc += src[i*nch + c];
+		}
+		dst[i] = g*acc;
+	}
+}
+
+static bool is_fill_scalar(const char *p, size_t n, uint8_t byte) {
+	for (size_t i = 0; i < n; i++) {
+		if ((uint8_t)p[i] != byte) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#ifdef DSP_X86
+__attribute__((target("sse2")))
+static void mix_sse2(float *dst, const float *src, size_t n, float gain) {
+	__m128 g = _mm_set1_ps(gain);
+	size_t i;
+	
+	for (i = 0; i+4 <= n; i += 4) {
+		_mm_storeu_ps(dst+i, _mm_add_ps(_mm_loadu_ps(dst+i), _mm_mul_ps(g, _mm_loadu_ps(src+i))));
+	}
+	mix_scalar(dst+i, src+i, n-i, gain);
+}
+
+__attribute__((target("sse2")))
+static void mix_mono_sse2(float *dst, const float *src, size_t frames, float gain) {
+	__m128 g = _mm_set1_ps(gain), s;
+	size_t i;
+	
+	for (i = 0; i+4 <= frames; i += 4) {
+		s = _mm_mul_ps(g, _mm_loadu_ps(src+i));
+		_mm_storeu_ps(dst+2*i, _mm_add_ps(_mm_loadu_ps(dst+2*i), _mm_unpacklo_ps(s, s)));
+		_mm_storeu_ps(dst+2*i+4, _mm_add_ps(_mm_loadu_ps(dst+2*i+4), _mm_unpackhi_ps(s, s)));
+	}
+	mix_mono_scalar(dst+2*i, src+i, frames-i, gain);
+}
+
+__attribute__((target("sse2")))
+static void saturate_sse2(float *buf, size_t n) {
+	__m128 hi = _mm_set1_ps(1.0f), lo = _mm_set1_ps(-1.0f);
+	size_t i;
+	
+	for (i = 0; i+4 <= n; i += 4) {
+		_mm_storeu_ps(buf+i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(buf+i), lo), hi));
+	}
+	saturate_scalar(buf+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static double energy_sse2(const float *buf, size_t n) {
+	float lanes[4];
+	double sum = 0.0;
+	__m128 acc, v;
+	size_t i, j, end;
+	
+	for (i = 0; i+4 <= n; i = end) {
+		end = (n - i < ENERGY_RUN) ? i + ((n - i) & ~(size_t)3) : i + ENERGY_RUN;
+		acc = _mm_setzero_ps();
+		for (j = i; j < end; j += 4) {
+			v = _mm_loadu_ps(buf+j);
+			acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+		}
+		_mm_storeu_ps(lanes, acc);
+		sum += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	return sum + energy_scalar(buf+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static float dot_sse2(const float *a, const float *b, size_t n) {
+	float lanes[4];
+	__m128 acc = _mm_setzero_ps();
+	size_t i;
+	
+	for (i = 0; i+4 <= n; i += 4) {
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+	}
+	_mm_storeu_ps(lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar(a+i, b+i, n-i);
+}
+
+/* Sixteen outputs at a time, each tap broadcast across them */
+__attribute__((target("sse2")))
+static float fir_peak_sse2(const float *x, const float *taps, size_t ntaps, size_t n) {
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 pk = _mm_setzero_ps(), t, a0, a1, a2, a3;
+	float lanes[4], m;
+	size_t i, j;
+	
+	for (i = 0; i+16 <= n; i += 16) {
+		a0 = a1 = a2 = a3 = _mm_setzero_ps();
+		for (j = 0; j < ntaps; j++) {
+			t = _mm_set1_ps(taps[j]);
+			a0 = _mm_add_ps(a0, _mm_mul_ps(t, _mm_loadu_ps(x+i+j)));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(t, _mm_loadu_ps(x+i+j+4)));
+			a2 = _mm_add_ps(a2, _mm_mul_ps(t, _mm_loadu_ps(x+i+j+8)));
+			a3 = _mm_add_ps(a3, _mm_mul_ps(t, _mm_loadu_ps(x+i+j+12)));
+		}
+		pk = _mm_max_ps(pk, _mm_max_ps(_mm_max_ps(_mm_and_ps(mask, a0), _mm_and_ps(mask, a1)),
+				_mm_max_ps(_mm_and_ps(mask, a2), _mm_and_ps(mask, a3))));
+	}
+	_mm_storeu_ps(lanes, pk);
+	m = fir_peak_scalar(x+i, taps, ntaps, n-i);
+	for (j = 0; j < 4; j++) {
+		m = lanes[j] > m ? lanes[j] : m;
+	}
+	return m;
+}
+
+/* Stereo pairs are averaged four frames at a time, other layouts as they come */
+__attribute__((target("sse2")))
+static void downmix_sse2(const float *src, float *dst, size_t frames, unsigned nch) {
+	__m128 half = _mm_set1_ps(0.5f), a, b;
+	size_t i = 0;
+	
+	if (nch == 2) {
+		for (; i+4 <= frames; i += 4) {
+			a = _mm_loadu_ps(src+2*i);
+			b = _mm_loadu_ps(src+2*i+4);
+			_mm_storeu_ps(dst+i, _mm_mul_ps(half, _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)),
+					_mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)))));
+		}
+	}
+	downmix_scalar(src+i*nch, dst+i, frames-i, nch);
+}
+
+/* Stops at the first 64 bytes that differ, which for sound is almost at once */
+__attribute__((target("sse2")))
+static bool is_fill_sse2(const char *p, size_t n, uint8_t byte) {
+	__m128i f = _mm_set1_epi8((char)byte), a, b;
+	size_t i;
+	
+	for (i = 0; i+64 <= n; i += 64) {
+		a = _mm_or_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(p+i)), f),
+				_mm_xor_si128(_mm_loadu_si128((const __m128i *)(p+i+16)), f));
+		b = _mm_or_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(p+i+32)), f),
+				_mm_xor_si128(_mm_loadu_si128((const __m128i *)(p+i+48)), f));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), _mm_setzero_si128())) != 0xFFFF) {
+			return false;
+		}
+	}
+	return is_fill_scalar(p+i, n-i, byte);
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(float *dst, const float *src, size_t n, float gain) {
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i;
+	
+	for (i = 0; i+8 <= n; i += 8) {
+		_mm256_storeu_ps(dst+i, _mm256_add_ps(_mm256_loadu_ps(dst+i), 
+				_mm256_mul_ps(g, _mm256_loadu_ps(src+i))));
+	}
+	mix_scalar(dst+i, src+i, n-i, gain);
+}
+
+__attribute__((target("avx2")))
+static void mix_mono_avx2(float *dst, const float *src, size_t frames, float gain) {
+	__m256 g = _mm256_set1_ps(gain), s, lo, hi;
+	size_t i;
+	
+	for (i = 0; i+8 <= frames; i += 8) {
+		s = _mm256_mul_ps(g, _mm256_loadu_ps(src+i));
+		/* Unpacking works within 128-bit lanes, put the halves back in order */
+		lo = _mm256_unpacklo_ps(s, s);
+		hi = _mm256_unpackhi_ps(s, s);
+		_mm256_storeu_ps(dst+2*i, _mm256_add_ps(_mm256_loadu_ps(dst+2*i), 
+				_mm256_permute2f128_ps(lo, hi, 0x20)));
+		_mm256_storeu_ps(dst+2*i+8, _mm256_add_ps(_mm256_loadu_ps(dst+2*i+8), 
+				_mm256_permute2f128_ps(lo, hi, 0x31)));
+	}
+	mix_mono_scalar(dst+2*i, src+i, frames-i, gain);
+}
+
+__attribute__((target("avx2")))
+static void saturate_avx2(float *buf, size_t n) {
+	__m256 hi = _mm256_set1_ps(1.0f), lo = _mm256_set1_ps(-1.0f);
+	size_t i;
+	
+	for (i = 0; i+8 <= n; i += 8) {
+		_mm256_storeu_ps(buf+i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(buf+i), lo), hi));
+	}
+	saturate_scalar(buf+i, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static double energy_avx2(const float *buf, size_t n) {
+	float lanes[8];
+	double sum = 0.0;
+	__m256 acc, v;
+	size_t i, j, end;
+	
+	for (i = 0; i+8 <= n; i = end) {
+		end = (n - i < ENERGY_RUN) ? i + ((n - i) & ~(size_t)7) : i + ENERGY_RUN;
+		acc = _mm256_setzero_ps();
+		for (j = i; j < end; j += 8) {
+			v = _mm256_loadu_ps(buf+j);
+			acc = _mm256_fmadd_ps(v, v, acc);
+		}
+		_mm256_storeu_ps(lanes, acc);
+		for (j = 0; j < 8; j++) {
+			sum += lanes[j];
+		}
+	}
+	return sum + energy_scalar(buf+i, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, size_t n) {
+	float lanes[8];
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	size_t i;
+	
+	/* Two accumulators, so one multiply-add needn't wait for the last */
+	for (i = 0; i+16 <= n; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8), acc1);
+	}
+	if (i+8 <= n) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+		i += 8;
+	}
+	_mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7] +
+			dot_scalar(a+i, b+i, n-i);
+}
+
+/* Four runs of eight outputs, so the multiply-adds needn't wait on each other */
+__attribute__((target("avx2,fma")))
+static float fir_peak_avx2(const float *x, const float *taps, size_t ntaps, size_t n) {
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 pk = _mm256_setzero_ps(), t, a0, a1, a2, a3;
+	float lanes[8], m;
+	size_t i, j;
+	
+	for (i = 0; i+32 <= n; i += 32) {
+		a0 = a1 = a2 = a3 = _mm256_setzero_ps();
+		for (j = 0; j < ntaps; j++) {
+			t = _mm256_broadcast_ss(taps+j);
+			a0 = _mm256_fmadd_ps(t, _mm256_loadu_ps(x+i+j), a0);
+			a1 = _mm256_fmadd_ps(t, _mm256_loadu_ps(x+i+j+8), a1);
+			a2 = _mm256_fmadd_ps(t, _mm256_loadu_ps(x+i+j+16), a2);
+			a3 = _mm256_fmadd_ps(t, _mm256_loadu_ps(x+i+j+24), a3);
+		}
+		pk = _mm256_max_ps(pk, _mm256_max_ps(_mm256_max_ps(_mm256_and_ps(mask, a0), _mm256_and_ps(mask, a1)),
+				_mm256_max_ps(_mm256_and_ps(mask, a2), _mm256_and_ps(mask, a3))));
+	}
+	_mm256_storeu_ps(lanes, pk);
+	m = fir_peak_sse2(x+i, taps, ntaps, n-i);
+	for (j = 0; j < 8; j++) {
+		m = lanes[j] > m ? lanes[j] : m;
+	}
+	return m;
+}
+
+__attribute__((target("avx2")))
+static void downmix_avx2(const float *src, float *dst, size_t frames, unsigned nch) {
+	__m256 half = _mm256_set1_ps(0.5f), a, b, s;
+	size_t i = 0;
+	
+	if (nch == 2) {
+		for (; i+8 <= frames; i += 8) {
+			a = _mm256_loadu_ps(src+2*i);
+			b = _mm256_loadu_ps(src+2*i+8);
+			/* Shuffling works within 128-bit lanes, which leaves the frames as 0 1 4 5 2 3 6 7 */
+			s = _mm256_add_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)), _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+			s = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(s), _MM_SHUFFLE(3,1,2,0)));
+			_mm256_storeu_ps(dst+i, _mm256_mul_ps(half, s));
+		}
+	}
+	downmix_sse2(src+i*nch, dst+i, frames-i, nch);
+}
+
+__attribute__((target("avx2")))
+static bool is_fill_avx2(const char *p, size_t n, uint8_t byte) {
+	__m256i f = _mm256_set1_epi8((char)byte), a, b;
+	size_t i;
+	
+	for (i = 0; i+128 <= n; i += 128) {
+		a = _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p+i)), f),
+				_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p+i+32)), f));
+		b = _mm256_or_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p+i+64)), f),
+				_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(p+i+96)), f));
+		a = _mm256_or_si256(a, b);
+		if (!_mm256_testz_si256(a, a)) {
+			return false;
+		}
+	}
+	return is_fill_scalar(p+i, n-i, byte);
+}
+#endif
+
+class BufferOps {
+	public:
+		void (*mix)(float *dst, const float *src, size_t n, float gain);
+		void (*mix_mono)(float *dst, const float *src, size_t frames, float gain);
+		void (*saturate)(float *buf, size_t n);
+		bool (*is_fill)(const char *p, size_t n, uint8_t byte);
+		double (*energy)(const float *buf, size_t n);
+		float (*dot)(const float *a, const float *b, size_t n);
+		float (*fir_peak)(const float *x, const float *taps, size_t ntaps, size_t n);
+		void (*downmix)(const float *src, float *dst, size_t frames, unsigned nch);
+};
+
+static BufferOps select_ops() {
+	BufferOps o = { mix_scalar, mix_mono_scalar, saturate_scalar, is_fill_scalar, energy_scalar,
+			dot_scalar, fir_peak_scalar, downmix_scalar };
+	
+#ifdef DSP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		o.mix = mix_avx2;
+		o.mix_mono = mix_mono_avx2;
+		o.saturate = saturate_avx2;
+		o.is_fill = is_fill_avx2;
+		o.downmix = downmix_avx2;
+		if (__builtin_cpu_supports("fma")) {
+			o.energy = energy_avx2;
+			o.dot = dot_avx2;
+			o.fir_peak = fir_peak_avx2;
+		} else {
+			o.energy = energy_sse2;
+			o.dot = dot_sse2;
+			o.fir_peak = fir_peak_sse2;
+		}
+	} else if (__builtin_cpu_supports("sse2")) {
+		o.mix = mix_sse2;
+		o.mix_mono = mix_mono_sse2;
+		o.saturate = saturate_sse2;
+		o.is_fill = is_fill_sse2;
+		o.energy = energy_sse2;
+		o.dot = dot_sse2;
+		o.fir_peak = fir_peak_sse2;
+		o.downmix = downmix_sse2;
+	}
+#endif
+	return o;
+}
+
+static const BufferOps &buffer_ops() {
+	static const BufferOps ops = select_ops();
+	return ops;
+}
+
+void dsp_mix(float *dst, const float *src, size_t n, float gain) {
+	buffer_ops().mix(dst, src, n, gain);
+}
+
+void dsp_mix_mono(float *dst, const float *src, size_t frames, float gain) {
+	buffer_ops().mix_mono(dst, src, frames, gain);
+}
+
+void dsp_saturate(float *buf, size_t n) {
+	buffer_ops().saturate(buf, n);
+}
+
+/* Whether every byte is byte, as in digital silence */
+bool dsp_is_fill(const char *p, size_t n, uint8_t byte) {
+	return buffer_ops().is_fill(p, n, byte);
+}
+
+/* Sum of squares of n floats */
+double dsp_energy(const float *buf, size_t n) {
+	return buffer_ops().energy(buf, n);
+}
+
+/* Sum of a[i]*b[i], as a FIR filter needs */
+float dsp_dot(const float *a, const float *b, size_t n) {
+	return buffer_ops().dot(a, b, n);
+}
+
+/* Largest |y[i]|, i < n, for y the FIR filter taps run over x, which holds n+ntaps-1 */
+float dsp_fir_peak(const float *x, const float *taps, size_t ntaps, size_t n) {
+	return buffer_ops().fir_peak(x, taps, ntaps, n);
+}
+
+/* Mono dst from the average of every frame's nch channels */
+void dsp_downmix(const float *src, float *dst, size_t frames, unsigned nch) {
+	buffer_ops().downmix(src, dst, frames, nch);
+}
@@ -0,0 +1,168 @@
+#ifndef _SOUNDREC_DSP_HEADER_
+#define _SOUNDREC_DSP_HEADER_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <pulse/sample.h>
+
+/*
+ * Per-sample kernels, specialised at compile time on the sample type and
+ * the channel count (0 meaning "any", read at run time). The format is
+ * resolved once per clip through a Kernels table, never per sample.
+ */
+namespace dsp {
+
+struct U8 {
+	static constexpr size_t bytes = 1;
+	static float load(const char *p) {
+		return ((int)(uint8_t)*p - 128) * (1.0f/128);
+	}
+	/* Stores round to the nearest step and clamp after, so dither sees no dead zone at 0 */
+	static void store(char *p, float v) {
+		long i = lrintf(v * 128.0f) + 128;
+		*p = (char)(uint8_t)(i > 255 ? 255 : (i < 0 ? 0 : i));
+	}
+};
+
+struct S16 {
+	static constexpr size_t bytes = 2;
+	static float load(const char *p) {
+		int16_t s;
+		memcpy(&s, p, sizeof(s));
+		return s * (1.0f/32768);
+	}
+	static void store(char *p, float v) {
+		long i = lrintf(v * 32768.0f);
+		int16_t s = (int16_t)(i > 32767 ? 32767 : (i < -32768 ? -32768 : i));
+		memcpy(p, &s, sizeof(s));
+	}
+};
+
+struct S24 {
+	static constexpr size_t bytes = 3;
+	static float load(const char *p) {
+		int32_t s = (uint8_t)p[0] | ((uint8_t)p[1] << 8) | ((int32_t)(int8_t)p[2] << 16);
+		return s * (1.0f/8388608);
+	}
+	static void store(char *p, float v) {
+		long i = lrintf(v * 8388608.0f);
+		i = i > 8388607 ? 8388607 : (i < -8388608 ? -8388608 : i);
+		p[0] = (char)i;
+		p[1] = (char)(i >> 8);
+		p[2] = (char)(i >> 16);
+	}
+};
+
+struct S32 {
+	static constexpr size_t bytes = 4;
+	static float load(const char *p) {
+		int32_t s;
+		memcpy(&s, p, sizeof(s));
+		return s * (1.0f/2147483648.0f);
+	}
+	static void store(char *p, float v) {
+		long long i = llrint(v * 2147483648.0);
+		int32_t s = (int32_t)(i > 2147483647LL ? 2147483647LL : (i < -2147483648LL ? -2147483648LL : i));
+		memcpy(p, &s, sizeof(s));
+	}
+};
+
+struct F32 {
+	static constexpr size_t bytes = 4;
+	static float load(const char *p) {
+		float s;
+		memcpy(&s, p, sizeof(s));
+		return s;
+	}
+	static void store(char *p, float v) {
+		memcpy(p, &v, sizeof(v));
+	}
+};
+
+template <class F, unsigned C>
+struct Frame {
+	static constexpr size_t size(unsigned nch) {
+		return F::bytes * (C ? C : nch);
+	}
+};
+
+/* Largest absolute sample value over whole frames */
+template <class F, unsigned C>
+float peak(const char *src, size_t frames, unsigned nch) {
+	const size_t n = frames * (C ? C : nch);
+	float pk = 0.0f, v;
+
+	for (size_t i = 0; i < n; i++) {
+		v = F::load(src + i*F::bytes);
+		v = v < 0 ? -v : v;
+		pk = v > pk ? v : pk;
+	}
+	return pk;
+}
+
+/* Sum of squares, for RMS and energy over whole frames */
+template <class F, unsigned C>
+double energy(const char *src, size_t frames, unsigned nch) {
+	const size_t n = frames * (C ? C : nch);
+	float acc = 0.0f, v;
+	double sum = 0.0;
+
+	for (size_t i = 0; i < n; i++) {
+		v = F::load(src + i*F::bytes);
+		acc += v*v;
+		/* Keep the float accumulator short so long runs stay exact */
+		if ((i & 4095) == 4095) {
+			sum += acc;
+			acc = 0.0f;
+		}
+	}
+	return sum + acc;
+}
+
+template <class F, unsigned C>
+void to_float(const char *src, float *dst, size_t frames, unsigned nch) {
+	const size_t n = frames * (C ? C : nch);
+
+	for (size_t i = 0; i < n; i++) {
+		dst[i] = F::load(src + i*F::bytes);
+	}
+}
+
+template <class F, unsigned C>
+void from_float(const float *src, char *dst, size_t frames, unsigned nch) {
+	const size_t n = frames * (C ? C : nch);
+
+	for (size_t i = 0; i < n; i++) {
+		F::store(dst + i*F::bytes, src[i]);
+	}
+}
+
+}
+
+/* The kernels for one sample spec */
+class Kernels {
+	public:
+		size_t frame;
+		unsigned channels;
+		float (*peak)(const char *src, size_t frames, unsigned nch);
+		double (*energy)(const char *src, size_t frames, unsigned nch);
+		void (*to_float)(const char *src, float *dst, size_t frames, unsigned nch);
+		void (*from_float)(const float *src, char *dst, size_t frames, unsigned nch);
+};
+
+Kernels dsp_kernels(const pa_sample_spec *spec);
+
+/* Buffer operations, bound once to the best the CPU supports */
+void dsp_mix(float *dst, const float *src, size_t n, float gain);
+void dsp_mix_mono(float *dst, const float *src, size_t frames, float gain);
+void dsp_saturate(float *buf, size_t n);
+bool dsp_is_fill(const char *p, size_t n, uint8_t byte);
+double dsp_energy(const float *buf, size_t n);
+float dsp_dot(const float *a, const float *b, size_t n);
+float dsp_fir_peak(const float *x, const float *taps, size_t ntaps, size_t n);
+void dsp_downmix(const float *src, float *dst, size_t frames, unsigned nch);
+
+#endif
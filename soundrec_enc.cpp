@@ -0,0 +1,369 @@
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "soundrec_enc.hpp"
+
+using namespace std;
+
+/* Frames converted per libsndfile call */
+#define ENC_CHUNK 4096
+
+/* libsndfile sees the memory buffer or the file through these */
+static sf_count_t vio_filelen(void *data) {
+	return ((Encoder *)data)->stream->size.load();
+}
+
+static sf_count_t vio_seek(sf_count_t off, int whence, void *data) {
+	Encoder *e = (Encoder *)data;
+	
+	switch (whence) {
+		case SEEK_SET:
+			e->pos = off;
+			break;
+		case SEEK_CUR:
+			e->pos += off;
+			break;
+		case SEEK_END:
+			e->pos = e->stream->size.load() + off;
+			break;
+	}
+	return e->pos;
+}
+
+static sf_count_t vio_read(void *ptr, sf_count_t count, void *data) {
+	Encoder *e = (Encoder *)data;
+	Encoder *s = e->stream;
+	sf_count_t n = (sf_count_t)s->size.load() - e->pos;
+	
+	if (count < n) {
+		n = count;
+	}
+	if (n <= 0) {
+		return 0;
+	}
+	
+	if (s->fd >= 0) {
+		n = pread(s->fd, ptr, n, e->pos);
+		if (n < 0) {
+			return 0;
+		}
+	} else {
+		memcpy(ptr, &s->mem[e->pos], n);
+	}
+	e->pos += n;
+	return n;
+}
+
+static sf_count_t vio_write(const void *ptr, sf_count_t count, void *data) {
+	Encoder *e = (Encoder *)data;
+	sf_count_t n = count;
+	
+	if (e->fd >= 0) {
+		n = pwrite(e->fd, ptr, count, e->pos);
+		if (n < 0) {
+			return 0;
+		}
+	} else {
+		if ((size_t)(e->pos + count) > e->mem.size()) {
+			e->mem.resize(e->pos + count);
+		}
+		memcpy(&e->mem[e->pos], ptr, count);
+	}
+	e->pos += n;
+	if ((size_t)e->pos > e->size.load()) {
+		e->size.store(e->pos);
+	}
+	return n;
+}
+
+static sf_count_t vio_tell(void *data) {
+	return ((Encoder *)data)->pos;
+}
+
+static SF_VIRTUAL_IO vio = { vio_filelen, vio_seek, vio_read, vio_write, vio_tell };
+
+/* fd is the file to encode into, or -1 to keep the stream in memory */
+Encoder::Encoder(clip_codec c, const pa_sample_spec &ss, int f) : sf(NULL), pcm_off(0),
+		codec(c), spec(ss), k(dsp_kernels(&ss)), fd(f), pos(0), size(0), ok(false), stream(this) {}
+
+/*
+ * A decoder of its own over the finished stream, which must outlive it,
+ * so it can be read on another thread while this one is used as usual
+ */
+Encoder *Encoder::reader() {
+	Encoder *r = new Encoder(codec, spec, -1);
+	
+	r->stream = this;
+	r->ok = ok;
+	return r;
+}
+
+bool Encoder::open() {
+	SF_INFO info;
+	
+	memset(&info, 0, sizeof(info));
+	info.samplerate = spec.rate;
+	info.channels = spec.channels;
+	
+	if (codec == CODEC_OPUS) {
+		info.format = SF_FORMAT_OGG | SF_FORMAT_OPUS;
+	} else if (codec == CODEC_VORBIS) {
+		info.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
+	} else if (spec.format == PA_SAMPLE_U8) {
+		info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_S8;
+	} else if (spec.format == PA_SAMPLE_S16LE) {
+		info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+	} else {
+		/* FLAC stops at 24 bits */
+		info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+	}
+	
+	if (!sf_format_check(&info) || (sf = sf_open_virtual(&vio, SFM_WRITE, &info, this)) == NULL) {
+		fprintf(stderr, __FILE__": can't encode %u Hz, %u channels as %s: %s\n",
+				spec.rate, spec.channels, enc_extension(codec), sf_strerror(NULL));
+		return false;
+	}
+	
+	ok = true;
+	return true;
+}
+
+size_t Encoder::to_sf(const char *src, size_t frames) {
+	const unsigned nch = spec.channels;
+	size_t i, n, done = 0;
+	sf_count_t w;
+	
+	while (done < frames) {
+		n = frames - done < ENC_CHUNK ? frames - done : ENC_CHUNK;
+		
+		if (codec != CODEC_FLAC || spec.format == PA_SAMPLE_FLOAT32LE) {
+			scratch.resize(n*nch*sizeof(float));
+			k.to_float(src, (float *)&scratch[0], n, nch);
+			w = sf_writef_float(sf, (float *)&scratch[0], n);
+		} else if (spec.format == PA_SAMPLE_U8) {
+			short *s;
+			scratch.resize(n*nch*sizeof(short));
+			s = (short *)&scratch[0];
+			for (i = 0; i < n*nch; i++) {
+				s[i] = (short)(((int)(uint8_t)src[i] - 128) << 8);
+			}
+			w = sf_writef_short(sf, s, n);
+		} else if (spec.format == PA_SAMPLE_S16LE) {
+			scratch.resize(n*nch*sizeof(short));
+			memcpy(&scratch[0], src, n*nch*sizeof(short));
+			w = sf_writef_short(sf, (short *)&scratch[0], n);
+		} else {
+			int *s;
+			scratch.resize(n*nch*sizeof(int));
+			s = (int *)&scratch[0];
+			if (spec.format == PA_SAMPLE_S24LE) {
+				for (i = 0; i < n*nch; i++) {
+					s[i] = ((uint8_t)src[3*i] << 8) | ((uint8_t)src[3*i+1] << 16) | ((uint32_t)(uint8_t)src[3*i+2] << 24);
+				}
+			} else {
+				memcpy(s, src, n*nch*sizeof(int));
+			}
+			w = sf_writef_int(sf, s, n);
+		}
+		
+		if (w != (sf_count_t)n) {
+			break;
+		}
+		src += n*k.frame;
+		done += n;
+	}
+	return done;
+}
+
+/* Worker side: any number of bytes, frames may be split between calls */
+bool Encoder::write(const char *data, size_t nbytes) {
+	size_t n, frames;
+	
+	if (!ok) {
+		return false;
+	}
+	
+	if (!pcm.empty()) {
+		n = k.frame - pcm.size();
+		n = n < nbytes ? n : nbytes;
+		pcm.insert(pcm.end(), data, data+n);
+		data += n;
+		nbytes -= n;
+		
+		if (pcm.size() < k.frame) {
+			return true;
+		}
+		if (to_sf(&pcm[0], 1) != 1) {
+			ok = false;
+		}
+		pcm.clear();
+	}
+	
+	frames = nbytes/k.frame;
+	if (ok && to_sf(data, frames) != frames) {
+		ok = false;
+	}
+	pcm.assign(data + frames*k.frame, data + nbytes);
+	
+	if (!ok) {
+		fprintf(stderr, __FILE__": encoding failed: %s\n", sf_strerror(sf));
+	}
+	return ok;
+}
+
+bool Encoder::close() {
+	if (sf != NULL && sf_close(sf) != 0) {
+		ok = false;
+	}
+	sf = NULL;
+	pcm.clear();
+	return ok;
+}
+
+/* Starts reading the finished stream back from the beginning */
+bool Encoder::rewind() {
+	SF_INFO info;
+	
+	if (sf != NULL) {
+		sf_close(sf);
+	}
+	memset(&info, 0, sizeof(info));
+	pos = 0;
+	pcm.clear();
+	pcm_off = 0;
+	
+	sf = sf_open_virtual(&vio, SFM_READ, &info, this);
+	if (sf == NULL) {
+		fprintf(stderr, __FILE__": can't decode clip: %s\n", sf_strerror(NULL));
+		return false;
+	}
+	return true;
+}
+
+size_t Encoder::from_sf(char *dst, size_t frames) {
+	const unsigned nch = spec.channels;
+	sf_count_t n, i;
+	
+	if (codec != CODEC_FLAC || spec.format == PA_SAMPLE_FLOAT32LE) {
+		scratch.resize(frames*nch*sizeof(float));
+		n = sf_readf_float(sf, (float *)&scratch[0], frames);
+		if (n > 0) {
+			k.from_float((float *)&scratch[0], dst, n, nch);
+		}
+	} else if (spec.format == PA_SAMPLE_U8 || spec.format == PA_SAMPLE_S16LE) {
+		short *s;
+		scratch.resize(frames*nch*sizeof(short));
+		s = (short *)&scratch[0];
+		n = sf_readf_short(sf, s, frames);
+		for (i = 0; i < n*nch; i++) {
+			if (spec.format == PA_SAMPLE_U8) {
+				dst[i] = (char)((s[i] >> 8) + 128);
+			} else {
+				memcpy(dst + 2*i, &s[i], 2);
+			}
+		}
+	} else {
+		int *s;
+		scratch.resize(frames*nch*sizeof(int));
+		s = (int *)&scratch[0];
+		n = sf_readf_int(sf, s, frames);
+		for (i = 0; i < n*nch; i++) {
+			if (spec.format == PA_SAMPLE_S24LE) {
+				dst[3*i] = (char)(s[i] >> 8);
+				dst[3*i+1] = (char)(s[i] >> 16);
+				dst[3*i+2] = (char)(s[i] >> 24);
+			} else {
+				memcpy(dst + 4*i, &s[i], 4);
+			}
+		}
+	}
+	return n > 0 ? n : 0;
+}
+
+/* The next nbytes of decoded audio, in the clip's own format */
+size_t Encoder::read(char *data, size_t nbytes) {
+	size_t n, got = 0;
+	
+	while (got < nbytes) {
+		if (pcm_off == pcm.size()) {
+			pcm.resize(ENC_CHUNK*k.frame);
+			pcm.resize(from_sf(&pcm[0], ENC_CHUNK)*k.frame);
+			pcm_off = 0;
+			if (pcm.empty()) {
+				break;
+			}
+		}
+		n = pcm.size() - pcm_off;
+		n = n < nbytes - got ? n : nbytes - got;
+		memcpy(data + got, &pcm[pcm_off], n);
+		pcm_off += n;
+		got += n;
+	}
+	return got;
+}
+
+/* Writes the encoded stream out as it is */
+bool Encoder::save(const char *filename) {
+	char buf[65536];
+	size_t left = size.load(), off = 0;
+	ssize_t n;
+	int out;
+	
+	out = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (out < 0) {
+		printf("Save failed: %s\n", strerror(errno));
+		return false;
+	}
+	
+	while (left > 0) {
+		if (fd >= 0) {
+			n = pread(fd, buf, left < sizeof(buf) ? left : sizeof(buf), off);
+			if (n > 0) {
+				n = ::write(out, buf, n);
+			}
+		} else {
+			n = ::write(out, &mem[off], left);
+		}
+		if (n <= 0) {
+			break;
+		}
+		off += n;
+		left -= n;
+	}
+	
+	if (left > 0) {
+		/* A short temporary file sets no errno */
+		printf("Write failed: %s\n", n < 0 ? strerror(errno) : "encoded stream ends early");
+	}
+	/* Some file systems only report a failed write here */
+	if (::close(out) < 0) {
+		printf("Error closing: %s\n", strerror(errno));
+		return false;
+	}
+	return left == 0;
+}
+
+Encoder::~Encoder() {
+	if (sf != NULL) {
+		sf_close(sf);
+	}
+	if (fd >= 0) {
+		::close(fd);
+	}
+}
+
+const char *enc_extension(clip_codec c) {
+	switch (c) {
+		case CODEC_OPUS:
+			return ".opus";
+		case CODEC_VORBIS:
+			return ".ogg";
+		default:
+			return ".flac";
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef _SOUNDREC_ENC_HEADER_
+#define _SOUNDREC_ENC_HEADER_
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+#include <sndfile.h>
+
+#include "soundrec.hpp"
+#include "soundrec_dsp.hpp"
+
+/*
+ * A clip's audio compressed through libsndfile, held in memory or in a
+ * file. Written by one thread while recording, read back afterwards.
+ */
+class Encoder {
+	private:
+		SNDFILE *sf;
+		/* Part of a frame left over while writing, decoded bytes while reading */
+		std::vector<char> pcm;
+		size_t pcm_off;
+		std::vector<char> scratch;
+		size_t to_sf(const char *src, size_t frames);
+		size_t from_sf(char *dst, size_t frames);
+	public:
+		clip_codec codec;
+		pa_sample_spec spec;
+		Kernels k;
+		int fd;
+		std::vector<char> mem;
+		sf_count_t pos;
+		std::atomic<size_t> size;
+		bool ok;
+		/* Whose stream is read: this one's, or the one a reader() was made from */
+		Encoder *stream;
+		Encoder(clip_codec c, const pa_sample_spec &ss, int f);
+		Encoder *reader();
+		bool open();
+		bool write(const char *data, size_t nbytes);
+		bool close();
+		bool rewind();
+		size_t read(char *data, size_t nbytes);
+		bool save(const char *filename);
+		~Encoder();
+};
+
+const char *enc_extension(clip_codec c);
+
+#endif
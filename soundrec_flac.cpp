@@ -0,0 +1,210 @@
+
+#include <cstring>
+
+#include "soundrec_flac.hpp"
+
+using namespace std;
+
+enum { META_STREAMINFO = 0, META_SEEKTABLE = 3 };
+
+/* Built once, by whichever thread gets there first */
+class Crc16Table {
+	public:
+		uint16_t t[256];
+		Crc16Table() {
+			uint16_t c;
+			
+			for (unsigned i = 0; i < 256; i++) {
+				c = (uint16_t)(i << 8);
+				for (int j = 0; j < 8; j++) {
+					c = (c & 0x8000) ? (uint16_t)((c << 1) ^ 0x8005) : (uint16_t)(c << 1);
+				}
+				t[i] = c;
+			}
+		}
+};
+
+static uint8_t crc8(const uint8_t *p, size_t n) {
+	uint8_t c = 0;
+	
+	while (n-- > 0) {
+		c ^= *p++;
+		for (int i = 0; i < 8; i++) {
+			c = (c & 0x80) ? (uint8_t)((c << 1) ^ 0x07) : (uint8_t)(c << 1);
+		}
+	}
+	return c;
+}
+
+static uint16_t crc16(const uint8_t *p, size_t n) {
+	static const Crc16Table table;
+	uint16_t c = 0;
+	
+	while (n-- > 0) {
+		c = (uint16_t)(c << 8) ^ table.t[(c >> 8) ^ *p++];
+	}
+	return c;
+}
+
+static size_t meta_len(const uint8_t *p) {
+	return 4 + ((p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+/* Bytes in the UTF-8 style coded number at p */
+static size_t utf8_len(const uint8_t *p) {
+	size_t n;
+	
+	for (n = 0; n < 8 && (p[0] & (0x80 >> n)); n++);
+	return n == 0 ? 1 : n;
+}
+
+/* Codes v, up to 36 bits, the way frame numbers are; returns the length */
+static size_t put_utf8(uint8_t *b, uint64_t v) {
+	size_t n, i;
+	
+	if (v < 0x80) {
+		b[0] = (uint8_t)v;
+		return 1;
+	}
+	/* n bytes hold 5n+1 bits */
+	for (n = 2; n < 7 && v >= (uint64_t)1 << (5*n + 1); n++);
+	for (i = n-1; i > 0; i--) {
+		b[i] = 0x80 | (v & 0x3f);
+		v >>= 6;
+	}
+	b[0] = (uint8_t)((0xff00 >> n) | v);
+	return n;
+}
+
+/* The frame header's length, 0 if there isn't a frame at p */
+static size_t header_len(const uint8_t *p, size_t avail) {
+	size_t len, n;
+	unsigned bs, sr;
+	
+	if (avail < 6 || p[0] != 0xff || p[1] != 0xf8) {
+		return 0;
+	}
+	bs = p[2] >> 4;
+	sr = p[2] & 15;
+	n = utf8_len(p+4);
+	
+	len = 4 + n;
+	len += bs == 6 ? 1 : (bs == 7 ? 2 : 0);
+	len += sr == 12 ? 1 : (sr == 13 || sr == 14 ? 2 : 0);
+	
+	if (n == 1 && (p[4] & 0x80)) {
+		return 0;
+	}
+	if (n > 6 || len + 1 > avail || crc8(p, len) != p[len]) {
+		return 0;
+	}
+	return len + 1;
+}
+
+/* The length of the frame at p, which ends where another begins or at the end */
+static size_t frame_len(const uint8_t *p, size_t avail) {
+	size_t i;
+	
+	for (i = header_len(p, avail) + 2; i+1 < avail; i++) {
+		if (p[i] == 0xff && p[i+1] == 0xf8 && crc16(p, i) == 0 && header_len(p+i, avail-i) > 0) {
+			return i;
+		}
+	}
+	return crc16(p, avail) == 0 ? avail : 0;
+}
+
+/* The whole clip's header: this piece's, totals set for the clip, any seek table left out */
+static bool make_head(const vector<char> &s, size_t end, uint64_t total, vector<char> *head) {
+	const uint8_t *p = (const uint8_t *)&s[0];
+	size_t pos, len, last = 0;
+	uint8_t *q;
+	
+	head->assign(s.begin(), s.begin() + 4);
+	for (pos = 4; pos < end; pos += len) {
+		len = meta_len(p+pos);
+		if ((p[pos] & 0x7f) == META_SEEKTABLE) {
+			continue;
+		}
+		last = head->size();
+		head->insert(head->end(), s.begin() + pos, s.begin() + pos + len);
+		(*head)[last] &= 0x7f;
+	}
+	(*head)[last] |= 0x80;
+	
+	/* STREAMINFO comes first: frame sizes and the MD5 sum become unknown */
+	q = (uint8_t *)&(*head)[8];
+	memset(q+4, 0, 6);
+	q[13] = (q[13] & 0xf0) | (uint8_t)((total >> 32) & 0x0f);
+	q[14] = (uint8_t)(total >> 24);
+	q[15] = (uint8_t)(total >> 16);
+	q[16] = (uint8_t)(total >> 8);
+	q[17] = (uint8_t)total;
+	memset(q+18, 0, 16);
+	return true;
+}
+
+/*
+ * Every piece but the last must be a whole number of blocks long, for
+ * the frames to join up; false if this one can't be made to.
+ */
+bool flac_part(vector<char> &s, uint64_t first, vector<char> *head, uint64_t total) {
+	const uint8_t *p = (const uint8_t *)&s[0];
+	vector<char> out;
+	uint64_t samples, num, count = 0;
+	size_t pos = 4, hlen, flen, nlen, start;
+	unsigned blocksize;
+	uint8_t b[8];
+	uint16_t crc;
+	bool last = false;
+	
+	if (s.size() < 4 + 4 + 34 || memcmp(p, "fLaC", 4) != 0 || (p[4] & 0x7f) != META_STREAMINFO) {
+		return false;
+	}
+	blocksize = (p[8] << 8) | p[9];
+	samples = ((uint64_t)(p[21] & 0x0f) << 32) | ((uint64_t)p[22] << 24) | (p[23] << 16) | (p[24] << 8) | p[25];
+	if (blocksize == 0 || blocksize != (unsigned)((p[10] << 8) | p[11]) || first % blocksize != 0) {
+		return false;
+	}
+	num = first/blocksize;
+	
+	while (!last) {
+		if (pos + 4 > s.size()) {
+			return false;
+		}
+		last = p[pos] & 0x80;
+		pos += meta_len(p+pos);
+	}
+	if (pos > s.size() || (head != NULL && !make_head(s, pos, total, head))) {
+		return false;
+	}
+	
+	out.reserve(s.size() - pos + s.size()/256);
+	while (pos < s.size()) {
+		flen = frame_len(p+pos, s.size()-pos);
+		hlen = header_len(p+pos, s.size()-pos);
+		if (hlen == 0 || flen == 0) {
+			return false;
+		}
+		nlen = utf8_len(p+pos+4);
+		
+		start = out.size();
+		out.insert(out.end(), s.begin() + pos, s.begin() + pos + 4);
+		out.insert(out.end(), (char *)b, (char *)b + put_utf8(b, num + count));
+		out.insert(out.end(), s.begin() + pos + 4 + nlen, s.begin() + pos + hlen - 1);
+		out.push_back((char)crc8((const uint8_t *)&out[start], out.size() - start));
+		out.insert(out.end(), s.begin() + pos + hlen, s.begin() + pos + flen - 2);
+		crc = crc16((const uint8_t *)&out[start], out.size() - start);
+		out.push_back((char)(crc >> 8));
+		out.push_back((char)crc);
+		
+		pos += flen;
+		count++;
+	}
+	
+	/* A false sync mid-frame would have shown up as a frame too many or too few */
+	if (count != (samples + blocksize - 1)/blocksize) {
+		return false;
+	}
+	s.swap(out);
+	return true;
+}
@@ -0,0 +1,14 @@
+#ifndef _SOUNDREC_FLAC_HEADER_
+#define _SOUNDREC_FLAC_HEADER_
+
+#include <vector>
+#include <cstdint>
+
+/*
+ * Turns a FLAC stream encoded from a piece of a clip, starting first
+ * frames in, into frames that carry on from the pieces before it. With
+ * head, also makes the header for the whole clip of total frames.
+ */
+bool flac_part(std::vector<char> &s, uint64_t first, std::vector<char> *head, uint64_t total);
+
+#endif
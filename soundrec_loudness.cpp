@@ -0,0 +1,200 @@
+
+#include <cmath>
+#include <cstring>
+
+#include "soundrec_loudness.hpp"
+
+using namespace std;
+
+/* Taps of each true peak interpolation phase */
+#define PEAK_TAPS 16
+/* Frames measured at a time */
+#define LOUDNESS_CHUNK 1024
+
+static double sinc(double x) {
+	return x == 0.0 ? 1.0 : sin(M_PI*x)/(M_PI*x);
+}
+
+Loudness::Loudness(const pa_sample_spec &spec) : k(dsp_kernels(&spec)), nch(spec.channels),
+		z(4*spec.channels, 0.0), in_step(0), sum(0.0), nsteps(0), count(LOUDNESS_BINS, 0),
+		energy(LOUDNESS_BINS, 0.0), peak(0.0f) {
+	const double rate = spec.rate;
+	double kk, vh, vb, q, a0, d, row;
+	unsigned p, i;
+	
+	/* The BS.1770 filters, worked out for this rate as in libebur128 */
+	kk = tan(M_PI*1681.974450955533/rate);
+	q = 0.7071752369554196;
+	vh = pow(10.0, 3.999843853973347/20.0);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1.0 + kk/q + kk*kk;
+	shelf[0] = (vh + vb*kk/q + kk*kk)/a0;
+	shelf[1] = 2.0*(kk*kk - vh)/a0;
+	shelf[2] = (vh - vb*kk/q + kk*kk)/a0;
+	shelf[3] = 2.0*(kk*kk - 1.0)/a0;
+	shelf[4] = (1.0 - kk/q + kk*kk)/a0;
+	
+	kk = tan(M_PI*38.13547087602444/rate);
+	q = 0.5003270373238773;
+	a0 = 1.0 + kk/q + kk*kk;
+	highpass[0] = 1.0;
+	highpass[1] = -2.0;
+	highpass[2] = 1.0;
+	highpass[3] = 2.0*(kk*kk - 1.0)/a0;
+	highpass[4] = (1.0 - kk/q + kk*kk)/a0;
+	
+	step = (spec.rate + 5)/10;
+	
+	phases = spec.rate < 96000 ? 4 : (spec.rate < 192000 ? 2 : 1);
+	table.resize(phases*PEAK_TAPS);
+	recent.assign((PEAK_TAPS-1)*nch, 0.0f);
+	/* Phase p lands p/phases of a frame past the middle of the taps */
+	for (p = 0; p < phases; p++) {
+		row = 0.0;
+		for (i = 0; i < PEAK_TAPS; i++) {
+			d = PEAK_TAPS/2 - 1 + (double)p/phases - i;
+			table[p*PEAK_TAPS + i] = sinc(d)*0.5*(1.0 + cos(M_PI*d/(PEAK_TAPS/2)));
+			row += table[p*PEAK_TAPS + i];
+		}
+		for (i = 0; i < PEAK_TAPS; i++) {
+			table[p*PEAK_TAPS + i] /= row;
+		}
+	}
+}
+
+/*
+ * The true peak of a chunk, filtered a whole channel and phase at a time
+ * rather than with a call per sample
+ */
+void Loudness::oversample(const float *x, size_t frames) {
+	const size_t hist = PEAK_TAPS-1;
+	size_t i;
+	unsigned c, p;
+	float pk;
+	
+	plane.resize(hist + frames);
+	for (c = 0; c < nch; c++) {
+		memcpy(&plane[0], &recent[c*hist], hist*sizeof(float));
+		for (i = 0; i < frames; i++) {
+			plane[hist + i] = x[i*nch + c];
+		}
+		
+		/* Output i comes from the taps ending at input i */
+		for (p = 0; p < phases; p++) {
+			pk = dsp_fir_peak(&plane[0], &table[p*PEAK_TAPS], PEAK_TAPS, frames);
+			peak = pk > peak ? pk : peak;
+		}
+		memcpy(&recent[c*hist], &plane[frames], hist*sizeof(float));
+	}
+}
+
+void Loudness::process(const float *x, size_t frames) {
+	size_t i;
+	unsigned c;
+	double v, s, w, b;
+	double *zc;
+	int bin;
+	
+	oversample(x, frames);
+	
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < nch; c++) {
+			v = x[i*nch + c];
+			zc = &z[4*c];
+			s = shelf[0]*v + zc[0];
+			zc[0] = shelf[1]*v - shelf[3]*s + zc[1];
+			zc[1] = shelf[2]*v - shelf[4]*s;
+			w = s + zc[2];
+			zc[2] = -2.0*s - highpass[3]*w + zc[3];
+			zc[3] = s - highpass[4]*w;
+			sum += w*w;
+		}
+		
+		if (++in_step < step) {
+			continue;
+		}
+		steps[nsteps++ % 4] = sum/step;
+		in_step = 0;
+		sum = 0.0;
+		if (nsteps < 4) {
+			continue;
+		}
+		
+		/* A whole 400 ms block, kept if it clears the absolute gate of -70 LUFS */
+		b = (steps[0] + steps[1] + steps[2] + steps[3])/4;
+		if (b <= 0.0) {
+			continue;
+		}
+		bin = (int)floor((-0.691 + 10.0*log10(b) + 70.0)*10.0);
+		if (bin >= 0) {
+			bin = bin < LOUDNESS_BINS ? bin : LOUDNESS_BINS-1;
+			count[bin]++;
+			energy[bin] += b;
+		}
+	}
+}
+
+/* Any number of bytes in the stream's format, frames may be split between calls */
+void Loudness::add(const char *data, size_t nbytes) {
+	size_t n;
+	
+	if (!part.empty()) {
+		n = k.frame - part.size();
+		n = n < nbytes ? n : nbytes;
+		part.insert(part.end(), data, data + n);
+		data += n;
+		nbytes -= n;
+		if (part.size() < k.frame) {
+			return;
+		}
+		buf.resize(nch);
+		k.to_float(&part[0], &buf[0], 1, nch);
+		process(&buf[0], 1);
+		part.clear();
+	}
+	
+	buf.resize(LOUDNESS_CHUNK*nch);
+	while (nbytes >= k.frame) {
+		n = nbytes/k.frame < LOUDNESS_CHUNK ? nbytes/k.frame : LOUDNESS_CHUNK;
+		k.to_float(data, &buf[0], n, nch);
+		process(&buf[0], n);
+		data += n*k.frame;
+		nbytes -= n*k.frame;
+	}
+	part.assign(data, data + nbytes);
+}
+
+/* Integrated loudness in LUFS, -HUGE_VAL if no block got past the gates */
+double Loudness::integrated() {
+	double total = 0.0, gate;
+	uint64_t n = 0;
+	int i;
+	
+	for (i = 0; i < LOUDNESS_BINS; i++) {
+		total += energy[i];
+		n += count[i];
+	}
+	if (n == 0) {
+		return -HUGE_VAL;
+	}
+	
+	/* Relative gate 10 LU under the loudness of everything above the absolute one */
+	gate = -0.691 + 10.0*log10(total/n) - 10.0;
+	total = 0.0;
+	n = 0;
+	for (i = (int)ceil((gate + 70.0)*10.0 - 0.5); i < LOUDNESS_BINS; i++) {
+		if (i >= 0) {
+			total += energy[i];
+			n += count[i];
+		}
+	}
+	if (n == 0) {
+		return -HUGE_VAL;
+	}
+	return -0.691 + 10.0*log10(total/n);
+}
+
+/* Largest true peak so far, 1 being full scale */
+double Loudness::true_peak() {
+	return peak;
+}
@@ -0,0 +1,58 @@
+#ifndef _SOUNDREC_LOUDNESS_HEADER_
+#define _SOUNDREC_LOUDNESS_HEADER_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <pulse/sample.h>
+
+#include "soundrec_dsp.hpp"
+
+/* Gated block loudness kept in 0.1 LU steps from -70 to +10 LUFS */
+#define LOUDNESS_BINS 800
+
+/*
+ * EBU R128 loudness of a stream measured as it is written, so it is known
+ * once the last of it is in: K-weighted energy over 400 ms blocks every
+ * 100 ms, gated as in BS.1770, and the true peak from 4x oversampling (2x
+ * from 96 kHz, none from 192 kHz). Every channel is weighted as a front
+ * one. The memory used is the same however long the stream runs.
+ */
+class Loudness {
+	private:
+		Kernels k;
+		unsigned nch;
+		/* Both K-weighting stages, and their state per channel */
+		double shelf[5];
+		double highpass[5];
+		std::vector<double> z;
+		/* Frames a 100 ms step, frames and energy into the current one */
+		size_t step;
+		size_t in_step;
+		double sum;
+		/* The last four steps, making up the newest block */
+		double steps[4];
+		uint64_t nsteps;
+		/* Blocks above the absolute gate and their energy, by loudness */
+		std::vector<uint32_t> count;
+		std::vector<double> energy;
+		/* True peak: interpolation phases, the last taps-1 samples of each channel */
+		unsigned phases;
+		std::vector<float> table;
+		std::vector<float> recent;
+		float peak;
+		std::vector<char> part;
+		std::vector<float> buf;
+		/* One channel of a chunk after what came before it */
+		std::vector<float> plane;
+		void process(const float *x, size_t frames);
+		void oversample(const float *x, size_t frames);
+	public:
+		Loudness(const pa_sample_spec &spec);
+		void add(const char *data, size_t nbytes);
+		double integrated();
+		double true_peak();
+};
+
+#endif
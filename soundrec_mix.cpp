@@ -0,0 +1,286 @@
+
+#include <list>
+#include <deque>
+#include <vector>
+#include <cstring>
+#include <cassert>
+
+#include <glib.h>
+
+#include "soundrec_mix.hpp"
+#include "soundrec_pool.hpp"
+
+using namespace std;
+
+/* Input frames converted to float at a time */
+#define MIX_CHUNK 4096
+/* Blocks rendered ahead per worker before they are taken into the clip */
+#define MIX_AHEAD 2
+
+/*
+ * One block of output, rendered on a worker thread: len bytes from skip
+ * bytes into frame first, so the block fills whole even when frames
+ * straddle blocks
+ */
+class MixJob {
+	public:
+		const vector<MixSource> *src;
+		Kernels out;
+		int64_t first;
+		size_t frames;
+		size_t skip;
+		size_t len;
+		unsigned maxch;
+		char *block;
+		bool finished;
+};
+
+/* A mix under way: jobs in flight in output order, taken by the main loop as they finish */
+class Mix {
+	public:
+		vector<MixSource> src;
+		Clip *clip;
+		/* Bytes of output, and where the next job starts */
+		uint64_t size;
+		uint64_t next;
+		unsigned maxch;
+		size_t ahead;
+		deque<MixJob*> jobs;
+		GThreadPool *workers;
+		mix_done cb;
+		void *data;
+};
+
+namespace mix {
+	list<Mix*> running;
+	/* Rendered blocks of every mix, for the main loop to pick up */
+	GAsyncQueue *finished = NULL;
+}
+
+/* Folds any number of channels into stereo in place, even ones left */
+static void fold_stereo(float *buf, size_t frames, unsigned nch) {
+	float scale = 1.0f/((nch+1)/2);
+	float l, r;
+	
+	for (size_t i = 0; i < frames; i++) {
+		l = r = 0.0f;
+		for (unsigned c = 0; c < nch; c++) {
+			if (c & 1) {
+				r += buf[i*nch + c];
+			} else {
+				l += buf[i*nch + c];
+			}
+		}
+		buf[2*i] = l*scale;
+		buf[2*i+1] = r*scale;
+	}
+}
+
+/* Adds the part of a source that falls in [first, first+frames) to acc */
+static void mix_source(const MixSource &s, float *acc, int64_t first, size_t frames, char *raw, float *fl) {
+	const Kernels &k = s.clip->k;
+	int64_t len = s.clip->rec_size/k.frame;
+	int64_t from = first > s.offset ? first : s.offset;
+	int64_t to = first+(int64_t)frames;
+	const char *p;
+	size_t n, m, got, want;
+	
+	if (to > s.offset+len) {
+		to = s.offset+len;
+	}
+	
+	Cursor cr(s.clip, (from - s.offset)*k.frame);
+	
+	while (from < to) {
+		n = (to - from) < MIX_CHUNK ? (size_t)(to - from) : MIX_CHUNK;
+		
+		/* Frames may straddle blocks, so gather them before converting */
+		for (got = 0, want = n*k.frame; got < want; got += m) {
+			m = cr.next(&p, want-got);
+			memcpy(raw+got, p, m);
+		}
+		k.to_float(raw, fl, n, k.channels);
+		
+		if (k.channels == 1) {
+			dsp_mix_mono(acc + 2*(from-first), fl, n, s.gain);
+		} else {
+			if (k.channels > 2) {
+				fold_stereo(fl, n, k.channels);
+			}
+			dsp_mix(acc + 2*(from-first), fl, 2*n, s.gain);
+		}
+		from += n;
+	}
+}
+
+static gboolean mix_ready(void *);
+
+static void mix_job(gpointer data, gpointer) {
+	MixJob *job = (MixJob *)data;
+	vector<float> acc(2*job->frames, 0.0f);
+	vector<float> fl(MIX_CHUNK*job->maxch);
+	vector<char> raw(MIX_CHUNK*4*job->maxch);
+	size_t i;
+	
+	for (i = 0; i < job->src->size(); i++) {
+		mix_source((*job->src)[i], &acc[0], job->first, job->frames, &raw[0], &fl[0]);
+	}
+	
+	dsp_saturate(&acc[0], acc.size());
+	if (job->skip == 0 && job->len == job->frames*job->out.frame) {
+		job->out.from_float(&acc[0], job->block, job->frames, 2);
+	} else {
+		raw.resize(job->frames*job->out.frame);
+		job->out.from_float(&acc[0], &raw[0], job->frames, 2);
+		memcpy(job->block, &raw[job->skip], job->len);
+	}
+	
+	g_async_queue_push(mix::finished, job);
+	g_idle_add(mix_ready, NULL);
+}
+
+/* Keeps MIX_AHEAD blocks per worker on the way */
+static void queue_jobs(Mix *m) {
+	MixJob *job;
+	
+	const size_t frame = m->clip->k.frame;
+	
+	while (m->next < m->size && m->jobs.size() < m->ahead) {
+		job = new MixJob;
+		job->src = &m->src;
+		job->out = m->clip->k;
+		job->len = m->size - m->next < BLOCK_SIZE ? m->size - m->next : BLOCK_SIZE;
+		job->first = m->next/frame;
+		job->skip = m->next%frame;
+		job->frames = (job->skip + job->len + frame - 1)/frame;
+		job->maxch = m->maxch;
+		job->block = pool_get();
+		job->finished = false;
+		
+		m->jobs.push_back(job);
+		g_thread_pool_push(m->workers, job, NULL);
+		m->next += job->len;
+	}
+}
+
+/*
+ * The finished blocks at the front go into the clip as they are and more
+ * are queued; returns whether the mix is complete
+ */
+static bool advance(Mix *m) {
+	MixJob *job;
+	size_t i;
+	
+	while (!m->jobs.empty() && m->jobs.front()->finished) {
+		job = m->jobs.front();
+		m->jobs.pop_front();
+		m->clip->adopt(job->block, job->len);
+		delete job;
+	}
+	queue_jobs(m);
+	
+	if (!m->jobs.empty()) {
+		return false;
+	}
+	
+	g_thread_pool_free(m->workers, FALSE, TRUE);
+	for (i = 0; i < m->src.size(); i++) {
+		m->src[i].clip->saving--;
+	}
+	m->clip->finish();
+	
+	if (m->cb != NULL) {
+		m->cb(m->clip, m->data);
+	}
+	delete m;
+	return true;
+}
+
+/* Main loop side, for every mix under way */
+static gboolean mix_ready(void *) {
+	list<Mix*>::iterator it;
+	MixJob *job;
+	
+	while ((job = (MixJob *)g_async_queue_try_pop(mix::finished)) != NULL) {
+		job->finished = true;
+	}
+	for (it = mix::running.begin(); it != mix::running.end(); ) {
+		if (advance(*it)) {
+			it = mix::running.erase(it);
+		} else {
+			it++;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Sums the sources into a new stereo clip in the format and rate of the
+ * first one, in the background. Output blocks are rendered in parallel
+ * and handed to the clip in order as they are; cb gets the clip on the
+ * main loop once it is complete. The sources are held as a save would
+ * hold them until then.
+ */
+Clip *mix_clips(const vector<MixSource> &src, clip_store store, mix_done cb, void *data) {
+	pa_sample_spec spec = src[0].clip->spec;
+	Mix *m = new Mix;
+	int64_t end, total = 0;
+	size_t i;
+	
+	m->src = src;
+	m->next = 0;
+	m->maxch = 2;
+	m->cb = cb;
+	m->data = data;
+	
+	for (i = 0; i < src.size(); i++) {
+		assert(src[i].clip->spec.rate == spec.rate);
+		end = src[i].offset + (int64_t)(src[i].clip->rec_size/src[i].clip->k.frame);
+		if (end > total) {
+			total = end;
+		}
+		if (src[i].clip->spec.channels > m->maxch) {
+			m->maxch = src[i].clip->spec.channels;
+		}
+		src[i].clip->saving++;
+	}
+	
+	spec.channels = 2;
+	m->clip = new Clip(store, spec);
+	m->size = total*m->clip->k.frame;
+	
+	if (mix::finished == NULL) {
+		mix::finished = g_async_queue_new();
+	}
+	m->ahead = MIX_AHEAD*g_get_num_processors();
+	m->workers = g_thread_pool_new(mix_job, NULL, g_get_num_processors(), TRUE, NULL);
+	mix::running.push_back(m);
+	
+	queue_jobs(m);
+	if (m->jobs.empty()) {
+		g_idle_add(mix_ready, NULL);
+	}
+	return m->clip;
+}
+
+/* Whether a running mix reads or makes the clip */
+bool mix_uses(size_t id) {
+	list<Mix*>::iterator it;
+	size_t i;
+	
+	for (it = mix::running.begin(); it != mix::running.end(); it++) {
+		if ((*it)->clip->id == id) {
+			return true;
+		}
+		for (i = 0; i < (*it)->src.size(); i++) {
+			if ((*it)->src[i].clip->id == id) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool mix_busy() {
+	return !mix::running.empty();
+}
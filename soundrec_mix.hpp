@@ -0,0 +1,25 @@
+#ifndef _SOUNDREC_MIX_HEADER_
+#define _SOUNDREC_MIX_HEADER_
+
+#include <vector>
+#include <cstdint>
+
+#include "soundrec_clip.hpp"
+
+/* One clip going into a mix, offset in frames from the start of the mix */
+class MixSource {
+	public:
+		Clip *clip;
+		int64_t offset;
+		float gain;
+		MixSource(Clip *c, int64_t o, float g) : clip(c), offset(o), gain(g) {}
+};
+
+/* Gets the finished mix on the main loop */
+typedef void (*mix_done)(Clip *clip, void *data);
+
+Clip *mix_clips(const std::vector<MixSource> &src, clip_store store, mix_done cb, void *data);
+bool mix_uses(size_t id);
+bool mix_busy();
+
+#endif
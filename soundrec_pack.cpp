@@ -0,0 +1,293 @@
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include "soundrec_pack.hpp"
+
+/*
+ * Each channel is predicted from its last two samples, the residuals are
+ * Rice coded in partitions with their own predictor order and parameter.
+ * Blocks are packed independently, so any one can be restored on its own.
+ */
+
+/* Samples per partition, all channels counted */
+#define PACK_PART 4096
+/* Quotients this long are followed by the plain value instead */
+#define RICE_ESCAPE 16
+#define ESCAPE_BITS 40
+#define MAX_K 40
+
+enum { PACK_RAW, PACK_RICE };
+
+class BitWriter {
+	public:
+		uint8_t *out;
+		size_t pos;
+		uint64_t acc;
+		unsigned nbits;
+		BitWriter(char *o) : out((uint8_t *)o), pos(0), acc(0), nbits(0) {}
+		/* At most 56 bits at a time */
+		void put(uint64_t v, unsigned n) {
+			if (n == 0) {
+				return;
+			}
+			acc = (acc << n) | (v & ((~(uint64_t)0) >> (64-n)));
+			nbits += n;
+			while (nbits >= 8) {
+				out[pos++] = (uint8_t)(acc >> (nbits-8));
+				nbits -= 8;
+			}
+		}
+		void flush() {
+			if (nbits > 0) {
+				out[pos++] = (uint8_t)(acc << (8-nbits));
+				nbits = 0;
+			}
+		}
+};
+
+class BitReader {
+	public:
+		const uint8_t *p;
+		const uint8_t *end;
+		uint64_t acc;
+		unsigned nbits;
+		/* Padding bytes read past the end */
+		size_t over;
+		BitReader(const char *b, const char *e) : p((const uint8_t *)b), end((const uint8_t *)e),
+				acc(0), nbits(0), over(0) {}
+		void refill() {
+			while (nbits <= 56) {
+				acc <<= 8;
+				if (p < end) {
+					acc |= *p++;
+				} else {
+					over++;
+				}
+				nbits += 8;
+			}
+		}
+		/* Whether anything taken so far came from past the end */
+		bool overrun() {
+			return 8*over > nbits;
+		}
+		uint64_t get(unsigned n) {
+			if (n == 0) {
+				return 0;
+			}
+			refill();
+			nbits -= n;
+			return (acc >> nbits) & ((~(uint64_t)0) >> (64-n));
+		}
+		/* Leading one bits up to RICE_ESCAPE, and the zero ending them if any */
+		unsigned unary() {
+			unsigned q;
+			
+			refill();
+			q = __builtin_clzll(~(acc << (64-nbits)));
+			if (q >= RICE_ESCAPE) {
+				nbits -= RICE_ESCAPE;
+				return RICE_ESCAPE;
+			}
+			nbits -= q+1;
+			return q;
+		}
+};
+
+static int64_t load_sample(pa_sample_format_t f, const char *p) {
+	int16_t s16;
+	int32_t s32;
+	
+	switch (f) {
+		case PA_SAMPLE_U8:
+			return (int)(uint8_t)*p - 128;
+		case PA_SAMPLE_S16LE:
+			memcpy(&s16, p, sizeof(s16));
+			return s16;
+		case PA_SAMPLE_S24LE:
+			return (uint8_t)p[0] | ((uint8_t)p[1] << 8) | ((int32_t)(int8_t)p[2] << 16);
+		default:
+			/* Float samples go by their bit patterns */
+			memcpy(&s32, p, sizeof(s32));
+			return s32;
+	}
+}
+
+static void store_sample(pa_sample_format_t f, char *p, int64_t v) {
+	int16_t s16;
+	int32_t s32;
+	
+	switch (f) {
+		case PA_SAMPLE_U8:
+			*p = (char)(v + 128);
+			break;
+		case PA_SAMPLE_S16LE:
+			s16 = (int16_t)v;
+			memcpy(p, &s16, sizeof(s16));
+			break;
+		case PA_SAMPLE_S24LE:
+			p[0] = (char)v;
+			p[1] = (char)(v >> 8);
+			p[2] = (char)(v >> 16);
+			break;
+		default:
+			s32 = (int32_t)v;
+			memcpy(p, &s32, sizeof(s32));
+	}
+}
+
+static inline int64_t predict(unsigned order, int64_t h1, int64_t h2) {
+	return order == 0 ? 0 : (order == 1 ? h1 : 2*h1 - h2);
+}
+
+/* Where the first whole sample of the block starts and which channel it is */
+static void block_layout(const pa_sample_spec &spec, size_t off, size_t len,
+		size_t *head, size_t *nsamples, size_t *tail, unsigned *ch0) {
+	const size_t b = pa_sample_size(&spec);
+	
+	*head = (b - off%b) % b;
+	if (*head > len) {
+		*head = len;
+	}
+	*nsamples = (len - *head)/b;
+	*tail = len - *head - *nsamples*b;
+	*ch0 = ((off + *head)/b) % spec.channels;
+}
+
+/* A malloc()ed copy of the block, compressed if that makes it smaller */
+char *pack_block(const pa_sample_spec &spec, size_t off, const char *data, size_t len, size_t *packed_len) {
+	const size_t b = pa_sample_size(&spec);
+	const unsigned nch = spec.channels;
+	int64_t h1[PA_CHANNELS_MAX] = {0}, h2[PA_CHANNELS_MAX] = {0};
+	int64_t t1[PA_CHANNELS_MAX], t2[PA_CHANNELS_MAX];
+	uint64_t sum[3], u;
+	size_t head, nsamples, tail, i, j, n;
+	unsigned ch0, ch, order, kk, o;
+	int64_t x, r;
+	const char *s;
+	char *out;
+	
+	block_layout(spec, off, len, &head, &nsamples, &tail, &ch0);
+	
+	/* A partition can't grow past 7 bytes a sample, so checking between them is enough */
+	out = (char *)malloc(1 + len + 8*PACK_PART + 16);
+	if (out == NULL) {
+		return NULL;
+	}
+	
+	out[0] = PACK_RICE;
+	memcpy(out+1, data, head);
+	memcpy(out+1+head, data+head+nsamples*b, tail);
+	
+	BitWriter w(out+1+head+tail);
+	s = data+head;
+	
+	for (i = 0; i < nsamples && 1+head+tail+w.pos <= len; i += n) {
+		n = nsamples-i < PACK_PART ? nsamples-i : PACK_PART;
+		
+		/* Try every order on the partition, keep the cheapest */
+		memcpy(t1, h1, sizeof(t1));
+		memcpy(t2, h2, sizeof(t2));
+		sum[0] = sum[1] = sum[2] = 0;
+		for (j = 0, ch = (ch0+i)%nch; j < n; j++, ch = (ch+1 == nch) ? 0 : ch+1) {
+			x = load_sample(spec.format, s + (i+j)*b);
+			for (o = 0; o < 3; o++) {
+				r = x - predict(o, t1[ch], t2[ch]);
+				sum[o] += ((uint64_t)r << 1) ^ (uint64_t)(r >> 63);
+			}
+			t2[ch] = t1[ch];
+			t1[ch] = x;
+		}
+		order = sum[1] < sum[0] ? 1 : 0;
+		order = sum[2] < sum[order] ? 2 : order;
+		
+		for (kk = 0; kk < MAX_K && ((uint64_t)n << (kk+1)) <= sum[order]; kk++);
+		w.put(order, 2);
+		w.put(kk, 6);
+		
+		for (j = 0, ch = (ch0+i)%nch; j < n; j++, ch = (ch+1 == nch) ? 0 : ch+1) {
+			x = load_sample(spec.format, s + (i+j)*b);
+			r = x - predict(order, h1[ch], h2[ch]);
+			u = ((uint64_t)r << 1) ^ (uint64_t)(r >> 63);
+			
+			if ((u >> kk) >= RICE_ESCAPE) {
+				w.put((1 << RICE_ESCAPE) - 1, RICE_ESCAPE);
+				w.put(u, ESCAPE_BITS);
+			} else {
+				w.put((2 << (u >> kk)) - 2, (u >> kk) + 1);
+				w.put(u, kk);
+			}
+			h2[ch] = h1[ch];
+			h1[ch] = x;
+		}
+	}
+	w.flush();
+	
+	*packed_len = 1+head+tail+w.pos;
+	if (i < nsamples || *packed_len > len) {
+		out[0] = PACK_RAW;
+		memcpy(out+1, data, len);
+		*packed_len = 1+len;
+	}
+	
+	return (char *)realloc(out, *packed_len);
+}
+
+bool unpack_block(const pa_sample_spec &spec, size_t off, const char *packed, size_t packed_len, char *data, size_t len) {
+	const size_t b = pa_sample_size(&spec);
+	const unsigned nch = spec.channels;
+	int64_t h1[PA_CHANNELS_MAX] = {0}, h2[PA_CHANNELS_MAX] = {0};
+	size_t head, nsamples, tail, i, j, n;
+	unsigned ch0, ch, order, kk;
+	uint64_t u;
+	int64_t r, x;
+	char *d;
+	
+	if (packed_len < 1) {
+		return false;
+	}
+	if (packed[0] == PACK_RAW) {
+		if (packed_len != 1+len) {
+			return false;
+		}
+		memcpy(data, packed+1, len);
+		return true;
+	}
+	
+	block_layout(spec, off, len, &head, &nsamples, &tail, &ch0);
+	if (packed_len < 1+head+tail) {
+		return false;
+	}
+	
+	memcpy(data, packed+1, head);
+	memcpy(data+head+nsamples*b, packed+1+head, tail);
+	
+	BitReader rd(packed+1+head+tail, packed+packed_len);
+	d = data+head;
+	
+	for (i = 0; i < nsamples; i += n) {
+		n = nsamples-i < PACK_PART ? nsamples-i : PACK_PART;
+		order = rd.get(2);
+		kk = rd.get(6);
+		if (order > 2 || kk > MAX_K) {
+			return false;
+		}
+		
+		for (j = 0, ch = (ch0+i)%nch; j < n; j++, ch = (ch+1 == nch) ? 0 : ch+1) {
+			u = rd.unary();
+			if (u == RICE_ESCAPE) {
+				u = rd.get(ESCAPE_BITS);
+			} else {
+				u = (u << kk) | rd.get(kk);
+			}
+			r = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+			x = r + predict(order, h1[ch], h2[ch]);
+			store_sample(spec.format, d + (i+j)*b, x);
+			h2[ch] = h1[ch];
+			h1[ch] = x;
+		}
+	}
+	
+	return !rd.overrun();
+}
@@ -0,0 +1,15 @@
+#ifndef _SOUNDREC_PACK_HEADER_
+#define _SOUNDREC_PACK_HEADER_
+
+#include <cstddef>
+
+#include <pulse/sample.h>
+
+/*
+ * Lossless compression of single clip blocks. off is where the block
+ * starts in the clip, so samples split between blocks can be told apart.
+ */
+char *pack_block(const pa_sample_spec &spec, size_t off, const char *data, size_t len, size_t *packed_len);
+bool unpack_block(const pa_sample_spec &spec, size_t off, const char *packed, size_t packed_len, char *data, size_t len);
+
+#endif
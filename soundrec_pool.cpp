@@ -0,0 +1,157 @@
+
+#include <list>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include "soundrec_clip.hpp"
+#include "soundrec_pool.hpp"
+
+using namespace std;
+
+/*
+ * Process wide pool of page aligned BLOCK_SIZE buffers.
+ * Up to prealloc free blocks are kept faulted in ("hot"), further free
+ * blocks up to high_water are kept mapped but handed back to the kernel
+ * with madvise ("cold"), anything beyond that is unmapped.
+ */
+namespace pool {
+	GMutex lock;
+	list<char *> hot;
+	list<char *> cold;
+	size_t prealloc = 2;
+	size_t high_water = 16;
+}
+
+static void prefault(char *b) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	
+	for (size_t off = 0; off < BLOCK_SIZE; off += page) {
+		b[off] = 0;
+	}
+}
+
+static char *map_block() {
+	void *b = mmap(NULL, BLOCK_SIZE, PROT_READ | PROT_WRITE, 
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	
+	if (b == MAP_FAILED) {
+		fprintf(stderr, __FILE__": can't map block: %s\n", strerror(errno));
+		return NULL;
+	}
+	return (char *)b;
+}
+
+static void advise_free(char *b) {
+#ifdef MADV_FREE
+	if (madvise(b, BLOCK_SIZE, MADV_FREE) == 0) {
+		return;
+	}
+#endif
+	madvise(b, BLOCK_SIZE, MADV_DONTNEED);
+}
+
+/*
+ * Never NULL: like g_malloc(), running out aborts with a message rather
+ * than hand every caller a block it would have to check
+ */
+char *pool_get() {
+	char *b = NULL;
+	bool fault = false;
+	
+	g_mutex_lock(&pool::lock);
+	if (!pool::hot.empty()) {
+		b = pool::hot.front();
+		pool::hot.pop_front();
+	} else if (!pool::cold.empty()) {
+		b = pool::cold.front();
+		pool::cold.pop_front();
+		fault = true;
+	}
+	g_mutex_unlock(&pool::lock);
+	
+	if (b == NULL) {
+		b = map_block();
+		if (b == NULL) {
+			fprintf(stderr, __FILE__": out of memory for audio, giving up\n");
+			abort();
+		}
+	} else if (fault) {
+		prefault(b);
+	}
+	return b;
+}
+
+void pool_put(char *b) {
+	bool unmap = false;
+	
+	g_mutex_lock(&pool::lock);
+	if (pool::hot.size() < pool::prealloc) {
+		pool::hot.push_back(b);
+	} else if (pool::hot.size() + pool::cold.size() < pool::high_water) {
+		advise_free(b);
+		pool::cold.push_back(b);
+	} else {
+		unmap = true;
+	}
+	g_mutex_unlock(&pool::lock);
+	
+	if (unmap) {
+		munmap(b, BLOCK_SIZE);
+	}
+}
+
+void pool_set_limits(size_t prealloc, size_t high_water) {
+	g_mutex_lock(&pool::lock);
+	pool::prealloc = prealloc;
+	pool::high_water = (high_water < prealloc) ? prealloc : high_water;
+	g_mutex_unlock(&pool::lock);
+	
+	pool_trim();
+}
+
+/* Faults in enough blocks that the first prealloc expansions are free */
+void pool_fill() {
+	char *b;
+	
+	g_mutex_lock(&pool::lock);
+	while (pool::hot.size() < pool::prealloc) {
+		if (!pool::cold.empty()) {
+			b = pool::cold.front();
+			pool::cold.pop_front();
+			prefault(b);
+		} else if ((b = map_block()) == NULL) {
+			break;
+		}
+		pool::hot.push_back(b);
+	}
+	g_mutex_unlock(&pool::lock);
+}
+
+/* Brings the free lists back within the configured limits */
+void pool_trim() {
+	list<char *> unmap;
+	list<char *>::iterator it;
+	
+	g_mutex_lock(&pool::lock);
+	while (pool::hot.size() > pool::prealloc) {
+		advise_free(pool::hot.back());
+		pool::cold.push_front(pool::hot.back());
+		pool::hot.pop_back();
+	}
+	while (pool::hot.size() + pool::cold.size() > pool::high_water) {
+		unmap.push_back(pool::cold.back());
+		pool::cold.pop_back();
+	}
+	g_mutex_unlock(&pool::lock);
+	
+	for (it = unmap.begin(); it != unmap.end(); it++) {
+		munmap(*it, BLOCK_SIZE);
+	}
+}
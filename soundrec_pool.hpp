@@ -0,0 +1,13 @@
+#ifndef _SOUNDREC_POOL_HEADER_
+#define _SOUNDREC_POOL_HEADER_
+
+#include <cstddef>
+
+char *pool_get();
+void pool_put(char *block);
+
+void pool_set_limits(size_t prealloc, size_t high_water);
+void pool_fill();
+void pool_trim();
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef _SOUNDREC_RING_HEADER_
+#define _SOUNDREC_RING_HEADER_
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+/*
+ * Lock-free single-producer/single-consumer byte ring.
+ * The producer (the PulseAudio thread) only moves head, the consumer
+ * (the main loop) only moves tail, so neither side ever blocks.
+ */
+class Ring {
+	private:
+		char *data;
+		size_t mask;
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+		/* What put() deals in: bytes a frame, and the byte silence is made of */
+		size_t frame;
+		int silence;
+		/* Consumer side: the frame split by the end of the buffer, put back together */
+		char *bounce;
+		/* Puts in as much of what is owed as fits in whole frames */
+		void pay() {
+			size_t n = space();
+			
+			n -= n % frame;
+			n = n < owed ? n : owed;
+			if (n > 0) {
+				fill(silence, n);
+				owed -= n;
+			}
+		}
+	public:
+		/* Producer side: bytes of silence due for what put() had no room for */
+		size_t owed;
+		Ring(size_t size, size_t f = 1, int c = 0) : mask(size-1), head(0), tail(0), frame(f), silence(c), owed(0) {
+			assert((size & mask) == 0);
+			data = (char *)malloc(size);
+			bounce = (char *)malloc(f);
+		}
+		size_t size() {
+			return mask+1;
+		}
+		size_t readable() {
+			return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+		}
+		/* Producer side: bytes that can be written now */
+		size_t space() {
+			return size() - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+		}
+		/* All n bytes or none, so whole frames written stay whole; returns what went in */
+		size_t write(const char *src, size_t n) {
+			size_t h = head.load(std::memory_order_relaxed);
+			size_t off = h & mask;
+			size_t top;
+
+			if (n > space()) {
+				return 0;
+			}
+			top = size() - off;
+			if (n > top) {
+				memcpy(data+off, src, top);
+				memcpy(data, src+top, n-top);
+			} else {
+				memcpy(data+off, src, n);
+			}
+			head.store(h+n, std::memory_order_release);
+			return n;
+		}
+		/* Like write, with n bytes of c */
+		size_t fill(int c, size_t n) {
+			size_t h = head.load(std::memory_order_relaxed);
+			size_t off = h & mask;
+			size_t top;
+
+			if (n > space()) {
+				return 0;
+			}
+			top = size() - off;
+			if (n > top) {
+				memset(data+off, c, top);
+				memset(data, c, n-top);
+			} else {
+				memset(data+off, c, n);
+			}
+			head.store(h+n, std::memory_order_release);
+			return n;
+		}
+		/*
+		 * Producer side, for a stream of whole frames: a fragment goes in
+		 * whole, or is owed as silence instead, which goes in ahead of
+		 * whatever follows as soon as whole frames of it fit. So the stream
+		 * keeps its length and its frames stay in line whatever is lost.
+		 * NULL src is a hole, silence from the start. Returns false if src
+		 * had to be left out.
+		 */
+		bool put(const char *src, size_t n) {
+			pay();
+			if (src != NULL && owed == 0 && write(src, n) == n) {
+				return true;
+			}
+			owed += n;
+			pay();
+			return src == NULL;
+		}
+		/*
+		 * Contiguous readable region starting at tail, whole frames only.
+		 * The frame across the end of the buffer, when the frame size
+		 * doesn't divide the ring's, comes on its own through bounce, so
+		 * consumers never see a frame split.
+		 */
+		size_t peek(const char **ptr) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			size_t n = head.load(std::memory_order_acquire) - t;
+			size_t off = t & mask;
+			size_t top = size() - off;
+
+			if (n < frame) {
+				return 0;
+			}
+			if (top < frame) {
+				memcpy(bounce, data+off, top);
+				memcpy(bounce+top, data, frame-top);
+				*ptr = bounce;
+				return frame;
+			}
+			if (n > top) {
+				n = top;
+			}
+			*ptr = data+off;
+			return n - n%frame;
+		}
+		void consume(size_t n) {
+			tail.store(tail.load(std::memory_order_relaxed)+n, std::memory_order_release);
+		}
+		/* Only safe while the producer is stopped */
+		void reset() {
+			head.store(0);
+			tail.store(0);
+		}
+		~Ring() {
+			free(data);
+			free(bounce);
+		}
+};
+
+#endif
@@ -0,0 +1,207 @@
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "soundrec_rotate.hpp"
+#include "soundrec_wav.hpp"
+
+/* Longest file name the prefix expands to */
+#define NAME_MAX_LEN 512
+
+/* max_bytes is rounded down to whole frames, 0 or too much for WAV is as much as it holds */
+Rotator::Rotator(const pa_sample_spec &ss, const char *d, const char *p, uint64_t max_bytes, size_t ring_size) :
+		ring(new Ring(ring_size, pa_frame_size(&ss), ss.format == PA_SAMPLE_U8 ? 0x80 : 0)),
+		closing(false), behind(false), fd(-1), open(false), header(0), written(0), n(0),
+		spec(ss), dir(d), prefix(p) {
+	const size_t frame = pa_frame_size(&spec);
+	
+	if (max_bytes == 0 || max_bytes > WAV_MAX_DATA) {
+		max_bytes = WAV_MAX_DATA;
+	}
+	limit = max_bytes - max_bytes%frame;
+	if (limit == 0) {
+		limit = frame;
+	}
+	
+	g_mutex_init(&lock);
+	g_cond_init(&wake);
+	thread = g_thread_new("rotate", run, this);
+}
+
+/* Opens the next free name, the prefix with strftime() conversions filled in */
+void Rotator::begin() {
+	char stamp[NAME_MAX_LEN], path[NAME_MAX_LEN+32], hdr[WAV_HEADER];
+	time_t now = time(NULL);
+	struct tm tm;
+	
+	localtime_r(&now, &tm);
+	if (strftime(stamp, sizeof(stamp), prefix.c_str(), &tm) == 0) {
+		stamp[0] = '\0';
+	}
+	
+	do {
+		snprintf(path, sizeof(path), "%s/%s%u.wav", dir.c_str(), stamp, ++n);
+		fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	} while (fd < 0 && errno == EEXIST);
+	
+	/* Audio up to the next cut is lost, the files after still start on time */
+	if (fd < 0) {
+		fprintf(stderr, __FILE__": can't create %s: %s\n", path, strerror(errno));
+	} else {
+		/* Filled in once the size is known */
+		header = wav_header(hdr, &spec, 0);
+		if (::write(fd, hdr, header) != (ssize_t)header) {
+			fprintf(stderr, __FILE__": can't write %s: %s\n", path, strerror(errno));
+		}
+	}
+	open = true;
+	written = 0;
+}
+
+void Rotator::end() {
+	char hdr[WAV_HEADER];
+	const char pad = 0;
+	
+	if (fd >= 0) {
+		/* Chunks end on an even byte */
+		if ((written & 1) && pwrite(fd, &pad, 1, header + written) != 1) {
+			fprintf(stderr, __FILE__": can't finish segment %u: %s\n", n, strerror(errno));
+		}
+		wav_header(hdr, &spec, written);
+		if (pwrite(fd, hdr, header, 0) != (ssize_t)header || close(fd) < 0) {
+			fprintf(stderr, __FILE__": can't finish segment %u: %s\n", n, strerror(errno));
+		}
+		fd = -1;
+	}
+	open = false;
+}
+
+/* Cuts exactly at limit, which is whole frames */
+void Rotator::put(const char *data, size_t nbytes) {
+	size_t m;
+	ssize_t w;
+	
+	while (nbytes > 0) {
+		if (!open) {
+			begin();
+		}
+		m = limit - written < nbytes ? limit - written : nbytes;
+		
+		while (fd >= 0 && m > 0) {
+			w = ::write(fd, data, m);
+			if (w < 0 && errno == EINTR) {
+				continue;
+			}
+			if (w <= 0) {
+				fprintf(stderr, __FILE__": can't write segment %u: %s\n", n, strerror(errno));
+				break;
+			}
+			data += w;
+			nbytes -= w;
+			written += w;
+			m -= w;
+		}
+		/* Whatever could not be written still counts toward the cut */
+		data += m;
+		nbytes -= m;
+		written += m;
+		
+		if (written == limit) {
+			end();
+		}
+	}
+}
+
+void *Rotator::run(void *data) {
+	Rotator *r = (Rotator *)data;
+	const int c = r->spec.format == PA_SAMPLE_U8 ? 0x80 : 0;
+	char silence[4096];
+	const char *p;
+	size_t len;
+	bool last;
+	
+	for (;;) {
+		g_mutex_lock(&r->lock);
+		while (r->ring->readable() == 0 && !r->closing) {
+			g_cond_wait(&r->wake, &r->lock);
+		}
+		last = r->closing;
+		g_mutex_unlock(&r->lock);
+		
+		while ((len = r->ring->peek(&p)) > 0) {
+			r->put(p, len);
+			r->ring->consume(len);
+		}
+		if (last) {
+			break;
+		}
+	}
+	
+	/* The main loop is done with the ring, so the silence still owed can go straight out */
+	memset(silence, c, sizeof(silence));
+	len = sizeof(silence) - sizeof(silence)%pa_frame_size(&r->spec);
+	while (r->ring->owed > 0) {
+		len = r->ring->owed < len ? r->ring->owed : len;
+		r->put(silence, len);
+		r->ring->owed -= len;
+	}
+	r->end();
+	return NULL;
+}
+
+/* Whole frames into the ring, which owes silence for what doesn't fit, so the files keep time */
+void Rotator::push(const char *data, size_t nbytes) {
+	bool ok = ring->put(data, nbytes);
+	
+	if (!ok && !behind) {
+		fprintf(stderr, __FILE__": writer behind, filling with silence\n");
+	}
+	behind = !ok;
+}
+
+/* Main loop side, never blocks on the disk; takes any number of bytes */
+void Rotator::write(const char *data, size_t nbytes) {
+	const size_t frame = pa_frame_size(&spec);
+	size_t m;
+	
+	/* Complete the frame the last call ended in the middle of */
+	if (!part.empty()) {
+		m = frame - part.size() < nbytes ? frame - part.size() : nbytes;
+		part.insert(part.end(), data, data + m);
+		data += m;
+		nbytes -= m;
+		if (part.size() < frame) {
+			return;
+		}
+		push(&part[0], frame);
+		part.clear();
+	}
+	
+	m = nbytes - nbytes%frame;
+	if (m > 0) {
+		push(data, m);
+	}
+	part.assign(data + m, data + nbytes);
+	
+	g_mutex_lock(&lock);
+	g_cond_signal(&wake);
+	g_mutex_unlock(&lock);
+}
+
+/* Waits for everything written so far to reach the last file */
+Rotator::~Rotator() {
+	g_mutex_lock(&lock);
+	closing = true;
+	g_cond_signal(&wake);
+	g_mutex_unlock(&lock);
+	
+	g_thread_join(thread);
+	g_mutex_clear(&lock);
+	g_cond_clear(&wake);
+	delete ring;
+}
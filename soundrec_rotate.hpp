@@ -0,0 +1,51 @@
+#ifndef _SOUNDREC_ROTATE_HEADER_
+#define _SOUNDREC_ROTATE_HEADER_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <glib.h>
+#include <pulse/sample.h>
+
+#include "soundrec_ring.hpp"
+
+/*
+ * Writes a stream out as a run of WAV files, each holding limit bytes
+ * but the last, so that they join up with nothing lost or repeated.
+ * The main loop only copies into the ring; a thread of its own does the
+ * writing, completes each file's header and goes straight on to the next.
+ */
+class Rotator {
+	private:
+		Ring *ring;
+		GThread *thread;
+		GMutex lock;
+		GCond wake;
+		bool closing;
+		/* Main loop side: a partial frame, and whether the writer has fallen behind */
+		std::vector<char> part;
+		bool behind;
+		/* Writer side */
+		int fd;
+		bool open;
+		size_t header;
+		uint64_t written;
+		unsigned n;
+		void begin();
+		void end();
+		void put(const char *data, size_t nbytes);
+		void push(const char *data, size_t nbytes);
+		static void *run(void *data);
+	public:
+		pa_sample_spec spec;
+		std::string dir;
+		std::string prefix;
+		uint64_t limit;
+		Rotator(const pa_sample_spec &ss, const char *d, const char *p, uint64_t max_bytes, size_t ring_size);
+		void write(const char *data, size_t nbytes);
+		~Rotator();
+};
+
+#endif
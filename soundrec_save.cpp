@@ -0,0 +1,757 @@
+
+#include <map>
+#include <cmath>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include <glib.h>
+
+#include "soundrec_save.hpp"
+#include "soundrec_pack.hpp"
+#include "soundrec_pool.hpp"
+#include "soundrec_wav.hpp"
+#include "soundrec_flac.hpp"
+#include "soundrec_convert.hpp"
+
+using namespace std;
+
+/* Blocks written by one call */
+#define SAVE_BATCH 64
+/* Frames made as one piece on export, a multiple of 1152 and 4096 */
+#define EXPORT_PIECE (36864*8)
+/* Frames converted and passed on at a time within a piece */
+#define EXPORT_CHUNK 16384
+
+/* One clip being saved, everything the worker needs copied out of it */
+class SaveJob {
+	public:
+		Clip *clip;
+		size_t id;
+		string filename;
+		pa_sample_spec spec;
+		size_t size;
+		/* The backing file if it holds the clip in order, else the blocks */
+		int fd;
+		vector<char*> blocks;
+		vector<char*> packed;
+		vector<size_t> packed_len;
+		/* The encoded stream, when it goes out as it is */
+		Encoder *enc;
+		/* Decodes an encoded clip into blocks of the job's own, given back when it is done */
+		Encoder *dec;
+		vector<char*> decoded;
+		/* What to encode the blocks as, CODEC_NONE for WAV */
+		clip_codec codec;
+		/* The format written, and what turns the clip's into it if they differ */
+		pa_sample_spec out;
+		Converter *conv;
+		/* Frames written */
+		uint64_t frames;
+		atomic<size_t> done;
+		bool ok;
+		SaveJob(Clip *c, const char *f) : clip(c), id(c->id), filename(f), spec(c->spec),
+				size(c->rec_size), fd(-1), enc(NULL), dec(NULL), codec(CODEC_NONE), out(c->spec), conv(NULL),
+				frames(0), done(0), ok(false) {}
+		~SaveJob() {
+			for (size_t i = 0; i < decoded.size(); i++) {
+				pool_put(decoded[i]);
+			}
+			delete dec;
+			delete conv;
+		}
+};
+
+/* A stretch of the file made on its own, for a save to put in its place */
+class Piece {
+	public:
+		SaveJob *job;
+		uint64_t first;
+		size_t frames;
+		vector<char> out;
+		/* The whole stream's header, for a first FLAC piece */
+		vector<char> head;
+		bool ok;
+		bool finished;
+		Piece(SaveJob *j, uint64_t f, size_t n) : job(j), first(f), frames(n), ok(false), finished(false) {}
+};
+
+/* The blocks a thread reads from, keeping the last packed one it restored */
+class BlockReader {
+	public:
+		SaveJob *job;
+		size_t cached;
+		vector<char> scratch;
+		BlockReader(SaveJob *j) : job(j), cached((size_t)-1) {}
+		const char *block(size_t i);
+};
+
+namespace save {
+	GThreadPool *pool = NULL;
+	GAsyncQueue *finished = NULL;
+	/* Saves under way, by clip */
+	map<size_t,SaveJob*> jobs;
+	void (*done_cb)(size_t, bool) = NULL;
+	/* Files written to at once, whatever the number of threads */
+	unsigned writers = 2;
+	unsigned writing = 0;
+	GMutex lock;
+	GCond turn;
+	/* Converts and encodes pieces of clips, one thread per CPU */
+	GThreadPool *encoders = NULL;
+	GCond piece_done;
+	/* What clips are converted to on export, 0 or PA_SAMPLE_INVALID to keep */
+	pa_sample_spec export_spec = { PA_SAMPLE_INVALID, 0, 0 };
+	bool dither = true;
+	/* Normalising aims here, never letting the true peak past the ceiling */
+	double target = -23.0;
+	double ceiling = -1.0;
+}
+
+static void io_begin() {
+	g_mutex_lock(&save::lock);
+	while (save::writing >= save::writers) {
+		g_cond_wait(&save::turn, &save::lock);
+	}
+	save::writing++;
+	g_mutex_unlock(&save::lock);
+}
+
+static void io_end() {
+	g_mutex_lock(&save::lock);
+	save::writing--;
+	g_cond_signal(&save::turn);
+	g_mutex_unlock(&save::lock);
+}
+
+/* Room for the whole file up front, so it isn't grown a write at a time */
+static bool reserve(int fd, uint64_t total) {
+	if (fallocate(fd, 0, 0, total) == 0 || errno == EOPNOTSUPP || errno == ENOSYS) {
+		return true;
+	}
+	printf("Save failed: %s\n", strerror(errno));
+	return false;
+}
+
+/* Lets the kernel copy a clip straight out of its backing file */
+static bool save_from_fd(SaveJob *job, int fd, size_t hlen) {
+	loff_t in = 0, out = hlen;
+	size_t left = job->size;
+	ssize_t n;
+	
+	io_begin();
+	while (left > 0) {
+		n = copy_file_range(job->fd, &in, fd, &out, left, 0);
+		if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+			if (lseek(fd, out, SEEK_SET) < 0) {
+				break;
+			}
+			n = sendfile(fd, job->fd, &in, left);
+			out += n > 0 ? n : 0;
+		}
+		if (n <= 0) {
+			break;
+		}
+		left -= n;
+		job->done.store(job->size - left);
+	}
+	io_end();
+	
+	return left == 0;
+}
+
+/* All of iov at off, however many calls that takes; iov is used up */
+static bool write_iov(int fd, struct iovec *iov, int n, off_t *off) {
+	ssize_t w;
+	
+	io_begin();
+	while (n > 0) {
+		w = pwritev(fd, iov, n, *off);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			break;
+		}
+		*off += w;
+		while (n > 0 && (size_t)w >= iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	io_end();
+	
+	return n == 0;
+}
+
+/* Block i, restored into scratch if it is packed */
+static const char *block_data(SaveJob *job, size_t i, size_t len, vector<char> &scratch) {
+	if (job->blocks[i] != NULL) {
+		return job->blocks[i];
+	}
+	scratch.resize(BLOCK_SIZE);
+	if (!unpack_block(job->spec, i*BLOCK_SIZE, job->packed[i], job->packed_len[i], &scratch[0], len)) {
+		fprintf(stderr, __FILE__": block %zu of clip %zu is damaged\n", i, job->id);
+		memset(&scratch[0], job->spec.format == PA_SAMPLE_U8 ? 0x80 : 0, len);
+	}
+	return &scratch[0];
+}
+
+/*
+ * The blocks go from where they are straight into the file, SAVE_BATCH
+ * to a call. Packed blocks are restored into a buffer of the thread's
+ * own, so they unpack in parallel.
+ */
+static bool save_blocks(SaveJob *job, int fd, size_t hlen, char *hdr) {
+	struct iovec iov[SAVE_BATCH+2];
+	vector<char> scratch;
+	static const char pad = 0;
+	off_t off = 0;
+	size_t i, len;
+	int n = 0;
+	bool busy = false, ok = true;
+	
+	iov[n].iov_base = hdr;
+	iov[n++].iov_len = hlen;
+	
+	for (i = 0; i*BLOCK_SIZE < job->size && ok; i++) {
+		len = job->size - i*BLOCK_SIZE;
+		len = len < BLOCK_SIZE ? len : BLOCK_SIZE;
+		
+		if (job->blocks[i] == NULL) {
+			/* What the buffer holds has to go out before it is reused */
+			if (busy) {
+				ok = write_iov(fd, iov, n, &off);
+				n = 0;
+				job->done.store(off - hlen);
+			}
+			busy = true;
+		}
+		iov[n].iov_base = (void *)block_data(job, i, len, scratch);
+		iov[n++].iov_len = len;
+		
+		if (n >= SAVE_BATCH) {
+			ok = ok && write_iov(fd, iov, n, &off);
+			n = 0;
+			busy = false;
+			job->done.store(off - hlen);
+		}
+	}
+	
+	if (job->size & 1) {
+		iov[n].iov_base = (void *)&pad;
+		iov[n++].iov_len = 1;
+	}
+	return ok && write_iov(fd, iov, n, &off);
+}
+
+/* Plain PCM goes out as WAV, or RF64 past 4 GiB, written without libsndfile */
+static bool save_wav(SaveJob *job) {
+	char hdr[RF64_HEADER];
+	size_t hlen;
+	bool ok;
+	int fd;
+	
+	fd = open(job->filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		printf("Save failed: %s\n", strerror(errno));
+		return false;
+	}
+	
+	hlen = wav_header64(hdr, &job->spec, job->size);
+	ok = reserve(fd, hlen + job->size + (job->size & 1));
+	
+	if (ok) {
+		if (job->fd >= 0) {
+			ok = pwrite(fd, hdr, hlen, 0) == (ssize_t)hlen && save_from_fd(job, fd, hlen) &&
+					((job->size & 1) == 0 || pwrite(fd, "", 1, hlen + job->size) == 1);
+		} else {
+			ok = save_blocks(job, fd, hlen, hdr);
+		}
+		if (!ok) {
+			printf("Write failed: %s\n", strerror(errno));
+		}
+	}
+	if (close(fd) < 0) {
+		printf("Error closing\n");
+		ok = false;
+	}
+	job->done.store(job->size);
+	return ok;
+}
+
+const char *BlockReader::block(size_t i) {
+	size_t len = job->size - i*BLOCK_SIZE;
+	
+	if (job->blocks[i] != NULL) {
+		return job->blocks[i];
+	}
+	if (i != cached) {
+		block_data(job, i, len < BLOCK_SIZE ? len : BLOCK_SIZE, scratch);
+		cached = i;
+	}
+	return &scratch[0];
+}
+
+/* Source frames for a Converter, silence before and after the clip */
+static void read_frames(void *ctx, int64_t from, size_t count, char *dst) {
+	BlockReader *rd = (BlockReader *)ctx;
+	SaveJob *job = rd->job;
+	const size_t frame = pa_frame_size(&job->spec);
+	const int64_t total = job->size/frame;
+	const char fill = job->spec.format == PA_SAMPLE_U8 ? 0x80 : 0;
+	size_t pos, end, n;
+	
+	if (from < 0) {
+		n = (size_t)-from < count ? (size_t)-from : count;
+		memset(dst, fill, n*frame);
+		dst += n*frame;
+		from += n;
+		count -= n;
+	}
+	if (from + (int64_t)count > total) {
+		n = from >= total ? count : from + count - total;
+		memset(dst + (count - n)*frame, fill, n*frame);
+		count -= n;
+	}
+	
+	for (pos = from*frame, end = pos + count*frame; pos < end; pos += n, dst += n) {
+		n = BLOCK_SIZE - pos%BLOCK_SIZE;
+		n = n < end - pos ? n : end - pos;
+		memcpy(dst, rd->block(pos/BLOCK_SIZE) + pos%BLOCK_SIZE, n);
+	}
+}
+
+/* Into the piece's encoder if there is one, else into the piece as it is */
+static bool put(Piece *pc, Encoder *enc, const char *data, size_t n) {
+	if (enc != NULL) {
+		return enc->write(data, n);
+	}
+	pc->out.insert(pc->out.end(), data, data + n);
+	return true;
+}
+
+static void make_piece(void *data, void *) {
+	Piece *pc = (Piece *)data;
+	SaveJob *job = pc->job;
+	const size_t frame = pa_frame_size(&job->spec), out_frame = pa_frame_size(&job->out);
+	Encoder *enc = NULL;
+	BlockReader rd(job);
+	vector<char> pcm;
+	uint64_t f, end = pc->first + pc->frames;
+	size_t pos, n;
+	
+	pc->ok = true;
+	if (job->codec != CODEC_NONE) {
+		enc = new Encoder(job->codec, job->out, -1);
+		pc->ok = enc->open();
+	} else {
+		pc->out.reserve(pc->frames*out_frame);
+	}
+	
+	if (job->conv != NULL) {
+		for (f = pc->first; pc->ok && f < end; f += n) {
+			n = end - f < EXPORT_CHUNK ? end - f : EXPORT_CHUNK;
+			pcm.resize(n*out_frame);
+			job->conv->run(read_frames, &rd, f, n, &pcm[0]);
+			pc->ok = put(pc, enc, &pcm[0], n*out_frame);
+			job->done.fetch_add((job->conv->input_at(f + n) - job->conv->input_at(f))*frame);
+		}
+	} else {
+		for (pos = pc->first*frame; pc->ok && pos < end*frame; pos += n) {
+			n = BLOCK_SIZE - pos%BLOCK_SIZE;
+			n = n < end*frame - pos ? n : end*frame - pos;
+			pc->ok = put(pc, enc, rd.block(pos/BLOCK_SIZE) + pos%BLOCK_SIZE, n);
+			job->done.fetch_add(n);
+		}
+	}
+	
+	if (enc != NULL) {
+		pc->ok = enc->close() && pc->ok;
+		pc->out.swap(enc->mem);
+		pc->out.resize(enc->size.load());
+		delete enc;
+	}
+	/* FLAC frames are numbered from the start of the stream */
+	if (pc->ok && job->codec == CODEC_FLAC) {
+		pc->ok = flac_part(pc->out, pc->first, pc->first == 0 ? &pc->head : NULL, job->frames);
+	}
+	
+	g_mutex_lock(&save::lock);
+	pc->finished = true;
+	g_cond_broadcast(&save::piece_done);
+	g_mutex_unlock(&save::lock);
+}
+
+static bool write_all(int fd, const vector<char> &v, off_t *off) {
+	struct iovec iov;
+	
+	if (v.empty()) {
+		return true;
+	}
+	iov.iov_base = (void *)&v[0];
+	iov.iov_len = v.size();
+	return write_iov(fd, &iov, 1, off);
+}
+
+/*
+ * Cuts the file into pieces of piece frames, makes a few per CPU at a
+ * time on the encoder threads and writes them out in order at *pos as
+ * they are done. FLAC pieces are joined into one stream, Ogg ones simply
+ * follow each other as a chained stream.
+ */
+static bool save_pieces(SaveJob *job, int fd, uint64_t piece, off_t *pos) {
+	const size_t ahead = 2*g_get_num_processors();
+	vector<Piece*> pcs;
+	uint64_t first = 0;
+	size_t i;
+	bool ok = true;
+	
+	if (save::encoders == NULL) {
+		save::encoders = g_thread_pool_new(make_piece, NULL, g_get_num_processors(), FALSE, NULL);
+	}
+	
+	for (i = 0; i == 0 || i < pcs.size(); i++) {
+		while (pcs.size() < i + ahead && (pcs.empty() || first < job->frames)) {
+			pcs.push_back(new Piece(job, first, job->frames - first < piece ? job->frames - first : piece));
+			g_thread_pool_push(save::encoders, pcs.back(), NULL);
+			first += pcs.back()->frames;
+		}
+		
+		g_mutex_lock(&save::lock);
+		while (!pcs[i]->finished) {
+			g_cond_wait(&save::piece_done, &save::lock);
+		}
+		g_mutex_unlock(&save::lock);
+		
+		ok = ok && pcs[i]->ok && write_all(fd, pcs[i]->head, pos) && write_all(fd, pcs[i]->out, pos);
+		delete pcs[i];
+		pcs[i] = NULL;
+	}
+	return ok;
+}
+
+/*
+ * Encoded to the format the file name asks for, in pieces a multiple of
+ * every FLAC block size libsndfile may pick, so the frames line up
+ */
+static bool save_encoded(SaveJob *job) {
+	off_t pos = 0;
+	bool ok;
+	int fd;
+	
+	fd = open(job->filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		printf("Save failed: %s\n", strerror(errno));
+		return false;
+	}
+	
+	ok = save_pieces(job, fd, EXPORT_PIECE, &pos);
+	/* Most likely frames that didn't line up: once more as a single piece */
+	if (!ok && job->frames > EXPORT_PIECE && ftruncate(fd, 0) == 0) {
+		job->done.store(0);
+		pos = 0;
+		ok = save_pieces(job, fd, job->frames, &pos);
+	}
+	if (!ok) {
+		printf("Encoding failed\n");
+	}
+	if (close(fd) < 0) {
+		printf("Error closing\n");
+		ok = false;
+	}
+	return ok;
+}
+
+/* WAV in another sample format, rate or number of channels than the clip's */
+static bool save_converted(SaveJob *job) {
+	const uint64_t total = job->frames*pa_frame_size(&job->out);
+	char hdr[RF64_HEADER];
+	off_t pos;
+	bool ok;
+	int fd;
+	
+	fd = open(job->filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		printf("Save failed: %s\n", strerror(errno));
+		return false;
+	}
+	
+	pos = wav_header64(hdr, &job->out, total);
+	ok = reserve(fd, pos + total + (total & 1)) && pwrite(fd, hdr, pos, 0) == pos &&
+			save_pieces(job, fd, EXPORT_PIECE, &pos) && ((total & 1) == 0 || pwrite(fd, "", 1, pos) == 1);
+	if (!ok) {
+		printf("Write failed: %s\n", strerror(errno));
+	}
+	if (close(fd) < 0) {
+		printf("Error closing\n");
+		ok = false;
+	}
+	job->done.store(job->size);
+	return ok;
+}
+
+/*
+ * The blocks an encoded clip let go, decoded on the worker rather than
+ * the main loop; what can't be decoded becomes silence
+ */
+static void decode(SaveJob *job) {
+	vector<char> skip;
+	size_t i, len, got;
+	bool ok;
+	
+	for (i = 0; i < job->blocks.size() && job->blocks[i] != NULL; i++);
+	if (i == job->blocks.size()) {
+		return;
+	}
+	
+	ok = job->dec->ok && job->dec->rewind();
+	for (i = 0; i*BLOCK_SIZE < job->size; i++) {
+		len = job->size - i*BLOCK_SIZE;
+		len = len < BLOCK_SIZE ? len : BLOCK_SIZE;
+		
+		if (job->blocks[i] != NULL) {
+			/* Kept because encoding failed, the stream has it too if at all */
+			skip.resize(len);
+			ok = ok && job->dec->read(&skip[0], len) == len;
+			continue;
+		}
+		
+		job->blocks[i] = pool_get();
+		job->decoded.push_back(job->blocks[i]);
+		got = ok ? job->dec->read(job->blocks[i], len) : 0;
+		if (got < len) {
+			memset(job->blocks[i] + got, job->spec.format == PA_SAMPLE_U8 ? 0x80 : 0, len - got);
+			ok = false;
+		}
+	}
+	
+	if (!ok) {
+		fprintf(stderr, __FILE__": clip %zu could not be fully decoded\n", job->id);
+	}
+}
+
+static void run(SaveJob *job) {
+	if (job->dec != NULL) {
+		decode(job);
+	}
+	
+	if (job->enc != NULL) {
+		io_begin();
+		job->ok = job->enc->save(job->filename.c_str());
+		io_end();
+		job->done.store(job->size);
+	} else if (job->codec != CODEC_NONE) {
+		job->ok = save_encoded(job);
+	} else if (job->conv != NULL) {
+		job->ok = save_converted(job);
+	} else {
+		job->ok = save_wav(job);
+	}
+}
+
+static gboolean done_cb(void *) {
+	SaveJob *job;
+	
+	while ((job = (SaveJob *)g_async_queue_try_pop(save::finished)) != NULL) {
+		save::jobs.erase(job->id);
+		job->clip->saving--;
+		if (save::done_cb != NULL) {
+			save::done_cb(job->id, job->ok);
+		}
+		delete job;
+	}
+	return FALSE;
+}
+
+static void worker(void *data, void *) {
+	run((SaveJob *)data);
+	g_async_queue_push(save::finished, data);
+	g_idle_add(done_cb, NULL);
+}
+
+/* The format a file name asks for, by its extension; CODEC_NONE for WAV */
+static clip_codec file_codec(const char *filename) {
+	gchar *lower = g_ascii_strdown(filename, -1);
+	clip_codec c = CODEC_NONE;
+	
+	if (g_str_has_suffix(lower, ".flac")) {
+		c = CODEC_FLAC;
+	} else if (g_str_has_suffix(lower, ".opus")) {
+		c = CODEC_OPUS;
+	} else if (g_str_has_suffix(lower, ".ogg") || g_str_has_suffix(lower, ".oga")) {
+		c = CODEC_VORBIS;
+	}
+	g_free(lower);
+	return c;
+}
+
+/*
+ * The gain taking the clip to the target loudness, from what was measured
+ * as it was recorded; 1 if it is too short or quiet to tell
+ */
+static float normal_gain(Clip *clip) {
+	double lufs = clip->meter->integrated(), peak = clip->meter->true_peak(), db;
+	
+	if (std::isinf(lufs)) {
+		printf("Clip %zu is too short or quiet to normalise\n", clip->id);
+		return 1.0f;
+	}
+	db = save::target - lufs;
+	if (peak > 0.0 && 20.0*log10(peak) + db > save::ceiling) {
+		db = save::ceiling - 20.0*log10(peak);
+	}
+	return (float)pow(10.0, db/20.0);
+}
+
+/* Main loop side: the job holds on to the clip's blocks from here on */
+static SaveJob *prepare(Clip *clip, const char *filename, bool normalize) {
+	SaveJob *job;
+	float gain = normalize ? normal_gain(clip) : 1.0f;
+	
+	clip->sync(true);
+	job = new SaveJob(clip, filename);
+	job->codec = file_codec(filename);
+	
+	if (save::export_spec.format != PA_SAMPLE_INVALID) {
+		job->out.format = save::export_spec.format;
+	}
+	if (save::export_spec.rate != 0) {
+		job->out.rate = save::export_spec.rate;
+	}
+	if (save::export_spec.channels != 0) {
+		job->out.channels = save::export_spec.channels;
+	}
+	if (!pa_sample_spec_equal(&job->out, &job->spec) || gain != 1.0f) {
+		job->conv = new Converter(job->spec, job->out, save::dither, gain);
+	}
+	job->frames = job->size/pa_frame_size(&job->spec);
+	if (job->conv != NULL) {
+		job->frames = job->conv->frames(job->frames);
+	}
+	
+	/* Already encoded as asked for, the stream goes out as it is */
+	if (clip->enc != NULL && clip->enc->ok && clip->enc->codec == job->codec && job->conv == NULL) {
+		job->enc = clip->enc;
+	} else {
+		/* Encoded clips are decoded on the worker, by a decoder of the job's own */
+		if (clip->enc != NULL && clip->finished) {
+			job->dec = clip->enc->reader();
+		}
+		if (clip->contiguous() && job->codec == CODEC_NONE && job->conv == NULL) {
+			job->fd = clip->fd;
+		}
+		job->blocks = clip->blocks;
+		job->packed = clip->packed;
+		job->packed_len = clip->packed_len;
+		job->packed.resize(job->blocks.size(), NULL);
+		job->packed_len.resize(job->blocks.size(), 0);
+	}
+	
+	clip->saving++;
+	return job;
+}
+
+/* Saves the clip before returning */
+bool save_clip(Clip *clip, const char *filename) {
+	SaveJob *job = prepare(clip, filename, false);
+	bool ok;
+	
+	run(job);
+	ok = job->ok;
+	clip->saving--;
+	delete job;
+	return ok;
+}
+
+/*
+ * Queues the clip to be saved, one at a time per clip; the done callback
+ * gets the result on the main loop. With normalize it is brought to the
+ * target loudness on the way, in the same single pass.
+ */
+bool save_clip_async(Clip *clip, const char *filename, bool normalize) {
+	SaveJob *job;
+	
+	if (save::jobs.count(clip->id) > 0) {
+		return false;
+	}
+	if (save::finished == NULL) {
+		save::finished = g_async_queue_new();
+	}
+	if (save::pool == NULL) {
+		save::pool = g_thread_pool_new(worker, NULL, g_get_num_processors(), FALSE, NULL);
+	}
+	
+	job = prepare(clip, filename, normalize);
+	save::jobs[clip->id] = job;
+	g_thread_pool_push(save::pool, job, NULL);
+	return true;
+}
+
+/* How much of the clip has been saved, 0 to 1, or -1 if it isn't being saved */
+double save_progress(size_t id) {
+	map<size_t,SaveJob*>::iterator it = save::jobs.find(id);
+	
+	if (it == save::jobs.end()) {
+		return -1.0;
+	}
+	if (it->second->size == 0) {
+		return 0.0;
+	}
+	return (double)it->second->done.load()/it->second->size;
+}
+
+bool save_busy() {
+	return !save::jobs.empty();
+}
+
+/* Finishes every save under way, reporting them as usual */
+void save_wait() {
+	if (save::pool == NULL) {
+		return;
+	}
+	g_thread_pool_free(save::pool, FALSE, TRUE);
+	save::pool = NULL;
+	done_cb(NULL);
+}
+
+/* Files written at once, at least 1 */
+void save_set_writers(unsigned n) {
+	g_mutex_lock(&save::lock);
+	save::writers = n > 0 ? n : 1;
+	g_cond_broadcast(&save::turn);
+	g_mutex_unlock(&save::lock);
+}
+
+void save_set_done_cb(void (*cb)(size_t, bool)) {
+	save::done_cb = cb;
+}
+
+/*
+ * What saved clips are converted to: a format other than
+ * PA_SAMPLE_INVALID, a rate or a number of channels other than 0 replace
+ * the clip's own. Integer formats get TPDF dither if dither is set.
+ */
+void save_set_export(const pa_sample_spec *ss, bool dither) {
+	save::export_spec = *ss;
+	save::dither = dither;
+}
+
+/* Loudness in LUFS normalising aims for, and the highest true peak in dBTP */
+void save_set_loudness(double target, double ceiling) {
+	save::target = target;
+	save::ceiling = ceiling;
+}
@@ -0,0 +1,23 @@
+#ifndef _SOUNDREC_SAVE_HEADER_
+#define _SOUNDREC_SAVE_HEADER_
+
+#include <cstddef>
+
+#include "soundrec_clip.hpp"
+
+/*
+ * Saving clips to files on a pool of threads. Each save works from a copy
+ * of the clip's block pointers taken when it starts; the clip keeps every
+ * block it has until the save is over, see Clip::saving.
+ */
+bool save_clip(Clip *clip, const char *filename);
+bool save_clip_async(Clip *clip, const char *filename, bool normalize);
+double save_progress(size_t id);
+bool save_busy();
+void save_wait();
+void save_set_writers(unsigned n);
+void save_set_done_cb(void (*cb)(size_t, bool));
+void save_set_export(const pa_sample_spec *ss, bool dither);
+void save_set_loudness(double target, double ceiling);
+
+#endif
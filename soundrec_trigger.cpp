@@ -0,0 +1,105 @@
+
+#include <cmath>
+#include <cstring>
+
+#include "soundrec_trigger.hpp"
+#include "soundrec_clip.hpp"
+
+using namespace std;
+
+/* Frames converted to float at a time */
+#define TRIGGER_CHUNK 1024
+
+/* bytes is rounded down to whole frames */
+History::History(size_t bytes, size_t frame_size) : buf(bytes - bytes%frame_size),
+		head(0), used(0), frame(frame_size), total(0) {}
+
+/* Any number of bytes, the oldest are overwritten once full */
+void History::keep(const char *data, size_t nbytes) {
+	const size_t cap = buf.size();
+	size_t n;
+	
+	total += nbytes;
+	if (cap == 0) {
+		return;
+	}
+	if (nbytes >= cap) {
+		memcpy(&buf[0], data + (nbytes - cap), cap);
+		head = 0;
+		used = cap;
+		return;
+	}
+	
+	n = cap - head;
+	n = n < nbytes ? n : nbytes;
+	memcpy(&buf[head], data, n);
+	memcpy(&buf[0], data + n, nbytes - n);
+	head = (head + nbytes) % cap;
+	used = (used + nbytes > cap) ? cap : used + nbytes;
+}
+
+/* nbytes of the stream went elsewhere; what was kept no longer leads up to now */
+void History::pass(size_t nbytes) {
+	total += nbytes;
+	clear();
+}
+
+/* Records what was kept into the clip, oldest first from a frame boundary; returns the bytes */
+size_t History::replay(Clip *c) {
+	const size_t cap = buf.size();
+	size_t start, skip, n;
+	
+	skip = (frame - (total - used)%frame) % frame;
+	if (used <= skip) {
+		clear();
+		return 0;
+	}
+	start = (head + cap - used + skip) % cap;
+	n = used - skip;
+	
+	if (start + n > cap) {
+		c->record(&buf[start], cap - start);
+		c->record(&buf[0], n - (cap - start));
+	} else {
+		c->record(&buf[start], n);
+	}
+	clear();
+	return n;
+}
+
+void History::clear() {
+	head = 0;
+	used = 0;
+}
+
+Trigger::Trigger(const pa_sample_spec &ss, float lv) : fl(TRIGGER_CHUNK*ss.channels), pos(0),
+		last(false), spec(ss), k(dsp_kernels(&ss)), level(lv) {}
+
+/*
+ * Looks at all whole frames in the bytes at once, wherever the stream
+ * was split; bytes holding no whole frame keep the previous answer.
+ */
+bool Trigger::loud(const char *data, size_t nbytes) {
+	size_t skip = (k.frame - pos%k.frame) % k.frame;
+	size_t frames, done, n;
+	double sum = 0.0;
+	
+	pos += nbytes;
+	if (nbytes <= skip) {
+		return last;
+	}
+	data += skip;
+	frames = (nbytes - skip)/k.frame;
+	if (frames == 0) {
+		return last;
+	}
+	
+	for (done = 0; done < frames; done += n) {
+		n = frames - done < TRIGGER_CHUNK ? frames - done : TRIGGER_CHUNK;
+		k.to_float(data + done*k.frame, &fl[0], n, k.channels);
+		sum += dsp_energy(&fl[0], n*k.channels);
+	}
+	
+	last = sqrt(sum/(frames*k.channels)) >= level;
+	return last;
+}
@@ -0,0 +1,43 @@
+#ifndef _SOUNDREC_TRIGGER_HEADER_
+#define _SOUNDREC_TRIGGER_HEADER_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "soundrec_dsp.hpp"
+
+class Clip;
+
+/* The last stretch of a stream, kept in a buffer allocated up front */
+class History {
+	private:
+		std::vector<char> buf;
+		size_t head;
+		size_t used;
+		size_t frame;
+		/* Bytes of the stream so far, kept or not, to find frame boundaries */
+		uint64_t total;
+	public:
+		History(size_t bytes, size_t frame_size);
+		void keep(const char *data, size_t nbytes);
+		void pass(size_t nbytes);
+		size_t replay(Clip *c);
+		void clear();
+};
+
+/* Whether stretches of a stream are loud, by their RMS level */
+class Trigger {
+	private:
+		std::vector<float> fl;
+		uint64_t pos;
+		bool last;
+	public:
+		pa_sample_spec spec;
+		Kernels k;
+		float level;
+		Trigger(const pa_sample_spec &ss, float lv);
+		bool loud(const char *data, size_t nbytes);
+};
+
+#endif
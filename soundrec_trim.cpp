@@ -0,0 +1,101 @@
+
+#include <cmath>
+
+#include "soundrec_trim.hpp"
+#include "soundrec_clip.hpp"
+
+using namespace std;
+
+/* Seconds of audio the level is measured over */
+#define TRIM_WINDOW 0.02
+
+static size_t frames_of(double sec, const pa_sample_spec &spec) {
+	return (size_t)(sec*spec.rate + 0.5);
+}
+
+Trimmer::Trimmer(const pa_sample_spec &spec, float level, double hang_sec, double pad_sec) :
+		k(dsp_kernels(&spec)), floor(level), dropping(false) {
+	size_t w = frames_of(TRIM_WINDOW, spec);
+	
+	window = (w > 0 ? w : 1)*k.frame;
+	pad = frames_of(pad_sec, spec)*k.frame;
+	hangover = frames_of(hang_sec, spec)*k.frame;
+	/* Both pads have to fit in what is held back */
+	if (hangover < 2*pad + window) {
+		hangover = 2*pad + window;
+	}
+	
+	win.reserve(window);
+	fl.resize(window/k.frame*k.channels);
+}
+
+void Trimmer::window_done(Clip *c) {
+	const size_t frames = win.size()/k.frame;
+	clip_gap gap;
+	double rms;
+	size_t n;
+	
+	k.to_float(&win[0], &fl[0], frames, k.channels);
+	rms = sqrt(dsp_energy(&fl[0], frames*k.channels)/(frames*k.channels));
+	
+	if (rms >= floor) {
+		/* Whatever was held back is the pad before the sound, or too short to cut */
+		if (!quiet.empty()) {
+			c->append(&quiet[0], quiet.size());
+			quiet.clear();
+		}
+		c->append(&win[0], win.size());
+		dropping = false;
+		return;
+	}
+	
+	quiet.insert(quiet.end(), win.begin(), win.end());
+	
+	if (!dropping && quiet.size() > hangover) {
+		c->append(&quiet[0], pad);
+		quiet.erase(quiet.begin(), quiet.begin() + pad);
+		
+		gap.frame = c->rec_size/k.frame;
+		gap.length = 0;
+		gaps.push_back(gap);
+		dropping = true;
+	}
+	
+	/* Only the latest pad is kept, ready to go before the sound resumes */
+	if (dropping && quiet.size() > pad) {
+		n = quiet.size() - pad;
+		quiet.erase(quiet.begin(), quiet.begin() + n);
+		gaps.back().length += n/k.frame;
+	}
+}
+
+/* Any number of bytes, frames may be split between calls */
+void Trimmer::write(Clip *c, const char *data, size_t nbytes) {
+	size_t n;
+	
+	while (nbytes > 0) {
+		n = window - win.size();
+		n = n < nbytes ? n : nbytes;
+		win.insert(win.end(), data, data + n);
+		data += n;
+		nbytes -= n;
+		
+		if (win.size() == window) {
+			window_done(c);
+			win.clear();
+		}
+	}
+}
+
+/* Recording has stopped: everything held back goes into the clip */
+void Trimmer::flush(Clip *c) {
+	if (!quiet.empty()) {
+		c->append(&quiet[0], quiet.size());
+		quiet.clear();
+	}
+	if (!win.empty()) {
+		c->append(&win[0], win.size());
+		win.clear();
+	}
+	dropping = false;
+}
@@ -0,0 +1,38 @@
+#ifndef _SOUNDREC_TRIM_HEADER_
+#define _SOUNDREC_TRIM_HEADER_
+
+#include <vector>
+#include <cstddef>
+
+#include "soundrec.hpp"
+#include "soundrec_dsp.hpp"
+
+class Clip;
+
+/*
+ * Sits between capture and a clip, leaving out stretches where the level
+ * stays under a floor for longer than the hangover, all but a pad at
+ * either edge. What was left out, and where, is kept in gaps.
+ */
+class Trimmer {
+	private:
+		Kernels k;
+		float floor;
+		/* Sizes in bytes, whole frames */
+		size_t window;
+		size_t hangover;
+		size_t pad;
+		/* The window being filled, and quiet audio held back */
+		std::vector<char> win;
+		std::vector<char> quiet;
+		std::vector<float> fl;
+		bool dropping;
+		void window_done(Clip *c);
+	public:
+		std::vector<clip_gap> gaps;
+		Trimmer(const pa_sample_spec &spec, float level, double hang_sec, double pad_sec);
+		void write(Clip *c, const char *data, size_t nbytes);
+		void flush(Clip *c);
+};
+
+#endif
@@ -1,8 +1,12 @@
 
 #include <ctime>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include <cassert>
 #include <cstring>
+#include <cstdint>
 
 #include <gtk/gtk.h>
 #include <glib.h>
@@ -10,9 +14,11 @@
 #include "soundrec.hpp"
 #include "soundrec_dbus.hpp"
 #include "soundrec_dconf.hpp"
+#include "soundrec_conf.hpp"
 
 #define UIFILE "SoundRecorder.ui"
 #define CSSFILE "soundrec.css"
+#define CONFFILE "soundrec.conf"
 
 using namespace std;
 
@@ -24,9 +30,10 @@ class ClipData {
 		time_t latest;
 		size_t clipid;
 		int n;
+		int take;
 		GtkTreeIter iter;
-		ClipData(int num, size_t cid) : id(new char[10]), ts(new char[10]), 
-				start(time(NULL)), latest(start), clipid(cid), n(num) {
+		ClipData(int num, size_t cid, int tk) : id(new char[10]), ts(new char[10]), 
+				start(time(NULL)), latest(start), clipid(cid), n(num), take(tk) {
 			snprintf(id, 10, "Clip%d", num);
 			this->format_time();
 		}
@@ -55,6 +62,8 @@ GtkWidget *progress_bar;
 
 map<size_t,ClipData*> clip_map;
 int nclips = 0;
+/* Clips started by the same press of Record share a take */
+int ntakes = 0;
 
 GtkListStore *clip_list;
 GtkListStore *input_list;
@@ -77,16 +86,32 @@ GtkWidget *prefix_entry;
 GtkWidget *path_entry;
 	
 GtkWidget *save_fc;
+GtkWidget *normalize_check;
+
+/* The level bar follows the most recently started clip */
+size_t meter_clip = (size_t)-1;
 
 gboolean recording_cb(void *data) {
-	rec_state state = soundrec_get_state();
 	ClipData *dat = (ClipData *)data;
 	time_t now = time(NULL);
+	bool meter = (dat->clipid == meter_clip && !soundrec_is_playing());
+	rec_stats st;
 	
-	if (state != RECORDING) {
+	if (!soundrec_get_stats(dat->clipid, &st)) {
+		if (meter) {
+			gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(progress_bar), 0.0);
+		}
+		/* Triggered clips end by themselves */
+		if (!soundrec_is_recording()) {
+			gtk_button_set_label(GTK_BUTTON(record_button), "Record");
+		}
 		return FALSE;
 	}
 	
+	if (meter) {
+		gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(progress_bar), st.level);
+	}
+	
 	if (now == dat->latest) {
 		return TRUE;
 	}
@@ -99,8 +124,107 @@ gboolean recording_cb(void *data) {
 	return TRUE;
 }
 
-void add_clip(size_t id) {
-	ClipData *dat = new ClipData(++nclips, id);
+/* Shows what each clip costs in memory, which drops once idle clips are compressed */
+gboolean memory_cb(void *) {
+	map<size_t,ClipData*>::iterator it;
+	gchar *size;
+	
+	for (it = clip_map.begin(); it != clip_map.end(); it++) {
+		/* Clips being saved show how far that has got instead */
+		if (soundrec_get_save_progress(it->first) >= 0.0) {
+			continue;
+		}
+		size = g_format_size(soundrec_get_clip_memory(it->first));
+		gtk_list_store_set(clip_list, &(it->second->iter), 3, size, -1);
+		g_free(size);
+	}
+	return TRUE;
+}
+
+guint save_timer = 0;
+
+gboolean saving_cb(void *) {
+	map<size_t,ClipData*>::iterator it;
+	gchar buf[32];
+	double p;
+	
+	for (it = clip_map.begin(); it != clip_map.end(); it++) {
+		p = soundrec_get_save_progress(it->first);
+		if (p >= 0.0) {
+			snprintf(buf, sizeof(buf), "Saving %d%%", (int)(100*p));
+			gtk_list_store_set(clip_list, &(it->second->iter), 3, buf, -1);
+		}
+	}
+	
+	if (!soundrec_is_saving()) {
+		save_timer = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Saves in the background, progress shown in the clip list */
+bool save_clip(const char *fname, size_t id, bool normalize) {
+	if (!soundrec_save_clip_async(fname, id, normalize)) {
+		return false;
+	}
+	if (save_timer == 0) {
+		save_timer = g_timeout_add(250, saving_cb, NULL);
+	}
+	return true;
+}
+
+/* Clips of the last Save All still being saved, and the numbers of those that failed */
+set<size_t> batch;
+vector<int> batch_failed;
+
+/* One report for the whole of a Save All, once the last of it is done */
+void batch_report() {
+	string msg;
+	char num[16];
+	
+	if (!batch.empty() || batch_failed.empty()) {
+		return;
+	}
+	
+	msg = batch_failed.size() > 1 ? "Failed to save clips" : "Failed to save clip";
+	for (size_t i = 0; i < batch_failed.size(); i++) {
+		snprintf(num, sizeof(num), "%s %d", i > 0 ? "," : "", batch_failed[i]);
+		msg += num;
+	}
+	batch_failed.clear();
+	
+	gtk_label_set_text( GTK_LABEL(err_label), msg.c_str());
+	
+	gtk_dialog_run( GTK_DIALOG(err_dialog));
+	gtk_widget_hide(err_dialog);
+}
+
+/* A save finished */
+void saved_cb(size_t id, bool ok) {
+	gchar *size;
+	
+	if (clip_map.count(id) > 0) {
+		size = g_format_size(soundrec_get_clip_memory(id));
+		gtk_list_store_set(clip_list, &(clip_map[id]->iter), 3, size, -1);
+		g_free(size);
+	}
+	
+	if (batch.erase(id) > 0) {
+		if (!ok) {
+			batch_failed.push_back(clip_map.count(id) > 0 ? clip_map[id]->n : 0);
+		}
+		batch_report();
+	} else if (!ok) {
+		gtk_label_set_text( GTK_LABEL(err_label), "Failed to save");
+		
+		gtk_dialog_run( GTK_DIALOG(err_dialog));
+		gtk_widget_hide(err_dialog);
+	}
+}
+
+ClipData *add_clip(size_t id, int take) {
+	ClipData *dat = new ClipData(++nclips, id, take);
 	
 	gtk_list_store_prepend(clip_list, &(dat->iter));
 	gtk_list_store_set(clip_list, &(dat->iter), 0, dat->id, 1, dat->ts, 2, (gpointer)dat, -1);
@@ -108,67 +232,163 @@ void add_clip(size_t id) {
 	clip_map[id] = dat;
 	
 	g_timeout_add(100, recording_cb, (void *)dat);
+	return dat;
+}
+
+static void add_selected(GtkTreeModel *model, GtkTreePath *, GtkTreeIter *iter, void *data) {
+	list<Recordable*> *recs = (list<Recordable*> *)data;
+	Recordable *rec;
+	int col = (model == GTK_TREE_MODEL(input_list)) ? 4 : 1;
+	
+	gtk_tree_model_get(model, iter, col, &rec, -1);
+	recs->push_back(rec);
 }
 
-Recordable *get_record_input() {
+/* Every selected source of the visible list, or the first one if none is */
+void get_record_inputs(list<Recordable*> &recs) {
 	GtkTreeIter iter;
 	GtkTreeModel *model;
-	Recordable *rec = NULL;
+	GtkTreeSelection *select;
 	
 	if (gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON(app_button))) {
-		if (gtk_tree_selection_get_selected(input_select, &model, &iter)) {
-			gtk_tree_model_get(model, &iter, 4, &rec, -1);
-		} else {
-			if (gtk_tree_model_get_iter_first(model, &iter)) {
-				gtk_tree_model_get(model, &iter, 4, &rec, -1);
-				gtk_tree_selection_select_iter(input_select, &iter);
-			}
-		}
+		select = input_select;
 	} else if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(monitor_button))) {
-		if (gtk_tree_selection_get_selected(monitor_select, &model, &iter)) {
-			gtk_tree_model_get(model, &iter, 1, &rec, -1);
-		} else {
-			if (gtk_tree_model_get_iter_first(model, &iter)) {
-				gtk_tree_model_get(model, &iter, 1, &rec, -1);
-				gtk_tree_selection_select_iter(monitor_select, &iter);
-			}
-		}
+		select = monitor_select;
 	} else {
-		if (gtk_tree_selection_get_selected(mic_select, &model, &iter)) {
-			gtk_tree_model_get(model, &iter, 1, &rec, -1);
-		} else {
-			if (gtk_tree_model_get_iter_first(model, &iter)) {
-				gtk_tree_model_get(model, &iter, 1, &rec, -1);
-				gtk_tree_selection_select_iter(mic_select, &iter);
-			}
-		}
+		select = mic_select;
+	}
+	
+	gtk_tree_selection_selected_foreach(select, add_selected, &recs);
+	
+	/* Sound cards and microphones chosen in both lists go into one clip */
+	if (soundrec_get_multitrack() && select != input_select) {
+		recs.clear();
+		gtk_tree_selection_selected_foreach(monitor_select, add_selected, &recs);
+		gtk_tree_selection_selected_foreach(mic_select, add_selected, &recs);
 	}
 	
-	return rec;
+	if (recs.empty()) {
+		model = gtk_tree_view_get_model( gtk_tree_selection_get_tree_view(select));
+		if (gtk_tree_model_get_iter_first(model, &iter)) {
+			gtk_tree_selection_select_iter(select, &iter);
+			add_selected(model, NULL, &iter, &recs);
+		}
+	}
 }
 
 void on_record(GtkButton *) {
-	rec_state state = soundrec_get_state();
-	Recordable *rec;
+	list<Recordable*> recs;
+	list<Recordable*>::iterator it;
 	size_t id;
-	switch (state) {
-		case IDLE:
-			rec = get_record_input();
-			if (rec != NULL) {
-				id = soundrec_start_recording(rec);
-				add_clip(id);
-				gtk_button_set_label(GTK_BUTTON(record_button), "Stop");
-			} else {
-				printf("Can't record: no input selected\n");
-			}
-			break;
-		case RECORDING:
-			gtk_button_set_label(GTK_BUTTON(record_button), "Record");
-			soundrec_stop_recording();
-			break;
-		case PLAYING_BACK:
-			printf("Can't record: Is playing back\n");
-		default:;
+	
+	if (soundrec_is_recording()) {
+		gtk_button_set_label(GTK_BUTTON(record_button), "Record");
+		soundrec_stop_recording();
+		return;
+	}
+	
+	/* With a replay source the clip starts from the seconds it kept */
+	id = soundrec_record_replay();
+	if (id != (size_t)-1) {
+		add_clip(id, ++ntakes);
+		meter_clip = id;
+		gtk_button_set_label(GTK_BUTTON(record_button), "Stop");
+		return;
+	}
+	
+	get_record_inputs(recs);
+	if (recs.empty()) {
+		printf("Can't record: no input selected\n");
+		return;
+	}
+	
+	if (soundrec_get_multitrack() && recs.size() > 1) {
+		id = soundrec_start_multitrack(recs);
+		if (id == (size_t)-1) {
+			printf("Can't record: too many channels\n");
+			return;
+		}
+		add_clip(id, ++ntakes);
+		meter_clip = id;
+		gtk_button_set_label(GTK_BUTTON(record_button), "Stop");
+		return;
+	}
+	
+	/* One clip per source, all started together */
+	ntakes++;
+	for (it = recs.begin(); it != recs.end(); it++) {
+		id = soundrec_start_recording(*it);
+		add_clip(id, ntakes);
+		meter_clip = id;
+	}
+	gtk_button_set_label(GTK_BUTTON(record_button), "Stop");
+}
+
+/* The armed source started a clip */
+void trigger_cb(size_t id) {
+	add_clip(id, ++ntakes);
+	meter_clip = id;
+	gtk_button_set_label(GTK_BUTTON(record_button), "Stop");
+}
+
+/* Arms the first selected source, clips then start and stop by its level */
+void on_arm(GtkToggleButton *button) {
+	list<Recordable*> recs;
+	
+	if (!gtk_toggle_button_get_active(button)) {
+		soundrec_disarm();
+		return;
+	}
+	if (soundrec_is_armed()) {
+		printf("Can't arm: a source is kept for replay\n");
+		gtk_toggle_button_set_active(button, FALSE);
+		return;
+	}
+	
+	get_record_inputs(recs);
+	if (recs.empty() || !soundrec_arm(recs.front())) {
+		printf("Can't arm: no input selected\n");
+		gtk_toggle_button_set_active(button, FALSE);
+	}
+}
+
+/* Keeps the last seconds of the first selected source, for Record to start from */
+void on_replay(GtkToggleButton *button) {
+	list<Recordable*> recs;
+	
+	if (!gtk_toggle_button_get_active(button)) {
+		soundrec_disarm();
+		return;
+	}
+	if (soundrec_is_armed()) {
+		printf("Can't keep replay: a source is already armed\n");
+		gtk_toggle_button_set_active(button, FALSE);
+		return;
+	}
+	
+	get_record_inputs(recs);
+	if (recs.empty() || !soundrec_start_replay(recs.front())) {
+		printf("Can't keep replay: no input selected or Seconds is 0\n");
+		gtk_toggle_button_set_active(button, FALSE);
+	}
+}
+
+/* Captures the first selected source to files for as long as it is on */
+void on_rotate(GtkToggleButton *button) {
+	list<Recordable*> recs;
+	
+	if (!gtk_toggle_button_get_active(button)) {
+		soundrec_stop_rotation();
+		return;
+	}
+	if (soundrec_is_rotating()) {
+		return;
+	}
+	
+	get_record_inputs(recs);
+	if (recs.empty() || !soundrec_start_rotation(recs.front())) {
+		printf("Can't capture to files: no input selected\n");
+		gtk_toggle_button_set_active(button, FALSE);
 	}
 }
 
@@ -206,10 +426,9 @@ size_t get_selected_or_first_clip() {
 }
 
 gboolean playback_timeout(void *data) {
-	rec_state state = soundrec_get_state();
 	double pct;
 	
-	if (state == PLAYING_BACK) {
+	if (soundrec_is_playing()) {
 		pct = soundrec_get_progress();
 		gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(progress_bar), pct);
 		return TRUE;
@@ -221,48 +440,49 @@ gboolean playback_timeout(void *data) {
 }
 
 void on_playback(GtkButton *) {
-	rec_state state = soundrec_get_state();
 	size_t id;
-	switch (state) {
-		case IDLE:
-			id = get_selected_or_first_clip();
-			if (id != (size_t)-1) {
-				gtk_button_set_label(GTK_BUTTON(playback_button), "Stop");
-				g_timeout_add(100, playback_timeout, NULL);
-				soundrec_start_playback(id);
-			} else {
-				printf("No clip recorded\n");
-			}
-			break;
-		case PLAYING_BACK:
-			gtk_button_set_label(GTK_BUTTON(playback_button), "Playback");
-			soundrec_stop_playback();
-			break;
-		case RECORDING:
-			printf("Can't begin playback: Is recording\n");
-		default:;
+	
+	if (soundrec_is_playing()) {
+		gtk_button_set_label(GTK_BUTTON(playback_button), "Playback");
+		soundrec_stop_playback();
+		return;
+	}
+	
+	id = get_selected_or_first_clip();
+	if (id == (size_t)-1) {
+		printf("No clip recorded\n");
+	} else if (soundrec_clip_recording(id)) {
+		printf("Can't begin playback: Clip is recording\n");
+	} else {
+		gtk_button_set_label(GTK_BUTTON(playback_button), "Stop");
+		g_timeout_add(100, playback_timeout, NULL);
+		soundrec_start_playback(id);
 	}
 }
 
 void on_save(GtkButton *) {
-	rec_state state = soundrec_get_state();
-	char *f, *name;
+	char *f, *name, label[64];
 	size_t id, len;
-	GtkWidget *toplevel, *dialog;
+	GtkWidget *toplevel, *dialog, *check;
 	ClipData *clip;
+	double lufs, peak;
 	bool new_name = false;
 	
-	if (state == RECORDING) {
-		printf("Can't save clip: Is recording\n");
-		return;
-	}
-	
 	id = get_selected_clip();
 	if (id == (size_t)-1) {
 		printf("No clip selected\n");
 		return;
 	}
 	
+	if (soundrec_clip_recording(id)) {
+		printf("Can't save clip: Is recording\n");
+		return;
+	}
+	if (soundrec_get_save_progress(id) >= 0.0) {
+		printf("Can't save clip: Is being saved\n");
+		return;
+	}
+	
 	assert(clip_map.count(id) > 0);
 	clip = clip_map[id];
 	
@@ -288,10 +508,18 @@ void on_save(GtkButton *) {
 	
 	gtk_file_chooser_set_do_overwrite_confirmation (GTK_FILE_CHOOSER (dialog), TRUE);
 	gtk_file_chooser_set_current_name( GTK_FILE_CHOOSER(dialog), name);
+	
+	if (soundrec_get_loudness(id, &lufs, &peak)) {
+		snprintf(label, sizeof(label), "Normalise loudness (now %.1f LUFS, %.1f dBTP)", lufs, peak);
+	} else {
+		snprintf(label, sizeof(label), "Normalise loudness");
+	}
+	check = gtk_check_button_new_with_label(label);
+	gtk_file_chooser_set_extra_widget( GTK_FILE_CHOOSER(dialog), check);
 			
 	if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
 		f = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
-		soundrec_save_clip(f, id);
+		save_clip(f, id, gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON(check)));
 		g_free (f);
 	}
 	
@@ -324,7 +552,7 @@ void save_all_ok(GtkButton *ok, GtkDialog *dialog) {
 	size_t plen, len;
 	list<char *> fnames;
 	list<char *>::iterator fnit;
-	bool fail = false;
+	bool normalize;
 	
 	path = gtk_entry_get_text( GTK_ENTRY(path_entry));
 	
@@ -349,39 +577,37 @@ void save_all_ok(GtkButton *ok, GtkDialog *dialog) {
 	
 		snprintf(buf, len, "%s%d.wav", pbuf, it->second->n);
 		
+		fnames.push_back(buf);
+		
 		if (g_file_test(buf, G_FILE_TEST_EXISTS)) {
 			gtk_label_set_text( GTK_LABEL(err_label), "File already exists");
 			
 			gtk_dialog_run( GTK_DIALOG(err_dialog));
 			gtk_widget_hide(err_dialog);
 			
-			fail = true;
-			break;
+			for (fnit = fnames.begin(); fnit != fnames.end(); fnit++) {
+				free(*fnit);
+			}
+			free(pbuf);
+			return;
 		}
-		
-		fnames.push_back(buf);
 	}
 	
+	/* Saved in parallel, failures are reported together once the last is done */
+	normalize = gtk_toggle_button_get_active( GTK_TOGGLE_BUTTON(normalize_check));
 	for (it = clip_map.begin(), fnit = fnames.begin(); 
 			it != clip_map.end() && fnit != fnames.end(); 
 				it++, fnit++) {
-		if (!fail) {
-			soundrec_save_clip(*fnit, it->first); 
-			if (!g_file_test(*fnit, G_FILE_TEST_EXISTS)) {
-				gtk_label_set_text( GTK_LABEL(err_label), "Failed to save");
-				
-				gtk_dialog_run( GTK_DIALOG(err_dialog));
-				gtk_widget_hide(err_dialog);
-				
-				fail = true;
-			}
+		if (save_clip(*fnit, it->first, normalize)) {
+			batch.insert(it->first);
+		} else {
+			batch_failed.push_back(it->second->n);
 		}
 		free(*fnit);
 	}
 	
-	if (!fail) {
-		gtk_widget_hide( GTK_WIDGET(dialog));
-	}
+	gtk_widget_hide( GTK_WIDGET(dialog));
+	batch_report();
 	
 	free(pbuf);
 }
@@ -391,14 +617,17 @@ void save_all_cancel(GtkButton *cancel, GtkDialog *dialog) {
 }
 
 void on_save_all(GtkButton *save, GtkDialog *dialog) {
-	rec_state state = soundrec_get_state();
 	char *fname;
 	GtkTreeIter iter;
 	
-	if (state == RECORDING) {
+	if (soundrec_is_recording()) {
 		printf("Can't save clip: Is recording\n");
 		return;
 	}
+	if (soundrec_is_saving()) {
+		printf("Can't save clips: Still saving\n");
+		return;
+	}
 	
 	if (gtk_tree_model_get_iter_first( GTK_TREE_MODEL(clip_list), &iter)) {
 		fname = gtk_file_chooser_get_filename( GTK_FILE_CHOOSER(save_fc));
@@ -413,9 +642,7 @@ void on_save_all(GtkButton *save, GtkDialog *dialog) {
 }
 
 void on_clear(GtkButton *clear) {
-	rec_state state = soundrec_get_state();
 	size_t id = get_selected_clip();
-	size_t id_cur = get_first_clip();
 	ClipData *dat;
 	
 	if (id == (size_t)-1) {
@@ -423,11 +650,9 @@ void on_clear(GtkButton *clear) {
 		return;
 	}
 	
-	if (state == RECORDING || state == PLAYING_BACK) {
-		if (id == id_cur) {
-			printf("Can't clear: Is recording or playing back\n");
-			return;
-		}
+	if (soundrec_clip_in_use(id)) {
+		printf("Can't clear: Is recording, playing back or saving\n");
+		return;
 	}
 	
 	dat = clip_map[id];
@@ -438,15 +663,18 @@ void on_clear(GtkButton *clear) {
 }
 
 void on_clear_all(GtkButton *button, GtkDialog *dialog) {
-	rec_state state = soundrec_get_state();
 	GtkTreeIter iter;
 	gint resp;
 	map<size_t, ClipData*>::iterator it;
 
-	if (state == RECORDING || state == PLAYING_BACK) {
+	if (soundrec_get_state() != IDLE) {
 		printf("Can't clear: Is recording or playing back\n");
 		return;
 	}
+	if (soundrec_is_saving() || soundrec_is_mixing()) {
+		printf("Can't clear: Still saving or mixing\n");
+		return;
+	}
 	
 	if (gtk_tree_model_get_iter_first( GTK_TREE_MODEL(clip_list), &iter)) {
 		resp = gtk_dialog_run(dialog);
@@ -466,6 +694,73 @@ void on_clear_all(GtkButton *button, GtkDialog *dialog) {
 	}
 }
 
+/* Mixes under way, with the take and length each is listed with */
+map<size_t, pair<int, time_t> > mixing;
+
+/* Mixes the clips of the selected clip's take down to one stereo clip */
+void on_mix(GtkButton *) {
+	size_t id = get_selected_clip();
+	map<size_t, ClipData*>::iterator it;
+	vector<mix_input> in;
+	int64_t first = INT64_MAX;
+	time_t len = 0;
+	int take;
+	size_t i;
+	
+	if (id == (size_t)-1) {
+		printf("No clip selected\n");
+		return;
+	}
+	
+	take = clip_map[id]->take;
+	
+	for (it = clip_map.begin(); it != clip_map.end() && take != 0; it++) {
+		if (it->second->take != take) {
+			continue;
+		}
+		if (soundrec_clip_recording(it->first)) {
+			printf("Can't mix: Is recording\n");
+			return;
+		}
+		mix_input mi = { it->first, soundrec_get_start_time(it->first), 1.0f };
+		in.push_back(mi);
+		
+		first = mi.offset < first ? mi.offset : first;
+		len = it->second->latest - it->second->start > len ? it->second->latest - it->second->start : len;
+	}
+	
+	if (in.size() < 2) {
+		printf("Nothing to mix\n");
+		return;
+	}
+	
+	/* Keep the sources where they were relative to each other */
+	for (i = 0; i < in.size(); i++) {
+		in[i].offset -= first;
+	}
+	
+	/* Listed once it is done, see mixed_cb */
+	id = soundrec_mix_clips(&in[0], in.size());
+	if (id == (size_t)-1) {
+		printf("Can't mix these clips\n");
+		return;
+	}
+	mixing[id] = make_pair(take, len);
+}
+
+/* A mix finished */
+void mixed_cb(size_t id) {
+	pair<int, time_t> m = mixing[id];
+	ClipData *dat;
+	
+	mixing.erase(id);
+	dat = add_clip(id, 0);
+	snprintf(dat->id, 10, "Mix%d", m.first);
+	dat->latest = dat->start + m.second;
+	dat->format_time();
+	gtk_list_store_set(clip_list, &(dat->iter), 0, dat->id, 1, dat->ts, -1);
+}
+
 static void switch_to_sound_card() {
 	gtk_toggle_button_set_active( GTK_TOGGLE_BUTTON(monitor_button), TRUE);
 }
@@ -482,7 +777,7 @@ void create_sources_model(GtkTreeView **view, GtkListStore **list, GtkTreeSelect
 	*view = GTK_TREE_VIEW(gtk_tree_view_new_with_model( GTK_TREE_MODEL(*list)));
 	*select = gtk_tree_view_get_selection(*view);
 	
-	gtk_tree_selection_set_mode(*select, GTK_SELECTION_SINGLE);
+	gtk_tree_selection_set_mode(*select, GTK_SELECTION_MULTIPLE);
 	
 	gtk_tree_view_set_headers_visible(*view, FALSE);
 		
@@ -512,12 +807,13 @@ void create_clips_model(GtkTreeView *view, GtkListStore **list) {
 	g_object_set(edit, "editable", TRUE, NULL);
 	g_signal_connect(edit, "edited", G_CALLBACK(edited_cb), NULL);
 	
-	*list = gtk_list_store_new(3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_POINTER);
+	*list = gtk_list_store_new(4, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_POINTER, G_TYPE_STRING);
 	
 	gtk_tree_view_set_headers_visible(view, FALSE);
 	
 	gtk_tree_view_insert_column_with_attributes( view, -1, "Clip", edit, "text", 0, NULL);
 	gtk_tree_view_insert_column_with_attributes( view, -1, "Length", cell, "text", 1, NULL);
+	gtk_tree_view_insert_column_with_attributes( view, -1, "Memory", cell, "text", 3, NULL);
 	
 	gtk_tree_view_set_model(view, GTK_TREE_MODEL(*list));
 }
@@ -670,6 +966,10 @@ int main(int argc, char **argv) {
 	GtkWidget *save_all_button;
 	GtkWidget *clear_button;
 	GtkWidget *clear_all_button;
+	GtkWidget *mix_button;
+	GtkWidget *arm_button;
+	GtkWidget *replay_button;
+	GtkWidget *rotate_button;
 	
 	GtkWidget *save_dialog_button;
 	GtkWidget *cancel_button;
@@ -697,6 +997,10 @@ int main(int argc, char **argv) {
 	save_all_button = GTK_WIDGET (gtk_builder_get_object (builder, "SaveAllButton"));
 	clear_button = GTK_WIDGET (gtk_builder_get_object (builder, "ClearButton"));
 	clear_all_button = GTK_WIDGET (gtk_builder_get_object (builder, "ClearAllButton"));
+	mix_button = GTK_WIDGET (gtk_builder_get_object (builder, "MixButton"));
+	arm_button = GTK_WIDGET (gtk_builder_get_object (builder, "ArmButton"));
+	replay_button = GTK_WIDGET (gtk_builder_get_object (builder, "ReplayButton"));
+	rotate_button = GTK_WIDGET (gtk_builder_get_object (builder, "RotateButton"));
 	monitor_button = GTK_WIDGET (gtk_builder_get_object (builder, "MonitorButton"));
 	mic_button = GTK_WIDGET (gtk_builder_get_object (builder, "MicButton"));
 	app_button = GTK_WIDGET (gtk_builder_get_object (builder, "AppButton"));
@@ -706,6 +1010,7 @@ int main(int argc, char **argv) {
 	path_entry = GTK_WIDGET (gtk_builder_get_object (builder, "PathEntry"));
 	prefix_entry = GTK_WIDGET (gtk_builder_get_object (builder, "PrefixEntry"));
 	save_fc = GTK_WIDGET (gtk_builder_get_object (builder, "FileChooser"));
+	normalize_check = GTK_WIDGET (gtk_builder_get_object (builder, "NormaliseCheck"));
 	save_dialog_button = GTK_WIDGET (gtk_builder_get_object (builder, "SaveDialogButton"));
 	cancel_button = GTK_WIDGET (gtk_builder_get_object (builder, "CancelButton"));
 	
@@ -736,6 +1041,10 @@ int main(int argc, char **argv) {
 	g_signal_connect (clear_button, "clicked", G_CALLBACK (on_clear), NULL);
 	g_signal_connect (clear_all_button, "clicked", G_CALLBACK (on_clear_all), clear_dialog);
 	g_signal_connect (save_all_button, "clicked", G_CALLBACK (on_save_all), save_dialog);
+	g_signal_connect (mix_button, "clicked", G_CALLBACK (on_mix), NULL);
+	g_signal_connect (arm_button, "toggled", G_CALLBACK (on_arm), NULL);
+	g_signal_connect (replay_button, "toggled", G_CALLBACK (on_replay), NULL);
+	g_signal_connect (rotate_button, "toggled", G_CALLBACK (on_rotate), NULL);
 	g_signal_connect (monitor_button, "toggled", G_CALLBACK (on_toggled), monitor_view);
 	g_signal_connect (mic_button, "toggled", G_CALLBACK (on_toggled), mic_view);
 	g_signal_connect (app_button, "toggled", G_CALLBACK (on_toggled), input_view);
@@ -749,16 +1058,24 @@ int main(int argc, char **argv) {
 	
 	soundrec_set_inputs_cb(inputs_cb);
 	soundrec_set_sources_cb(sources_cb);
+	soundrec_set_trigger_cb(trigger_cb);
+	soundrec_set_mix_cb(mixed_cb);
+	soundrec_set_save_cb(saved_cb);
 	soundrec_set_dbus_cb(G_CALLBACK(on_record), G_CALLBACK(on_playback), 
 		G_CALLBACK(switch_to_sound_card), G_CALLBACK(switch_to_mic));
 		
+	soundrec_load_config(CONFFILE);
 	soundrec_init();
+	g_timeout_add_seconds(2, memory_cb, NULL);
 	
 	soundrec_reload_bindings();
 	soundrec_dbus_connect();
 	
 	gtk_widget_show(window);
 	gtk_main();
+	/* Saves still going are let finish, nobody is left to tell */
+	soundrec_set_save_cb(NULL);
+	soundrec_finish_saves();
 	
 	return 0;
 }
@@ -0,0 +1,84 @@
+
+#include <cstring>
+
+#include "soundrec_wav.hpp"
+
+static void put_le(char *p, uint64_t v, int bytes) {
+	for (int i=0; i<bytes; i++) {
+		p[i] = (char)(v >> (8*i));
+	}
+}
+
+/* The tail of the KSDATAFORMAT_SUBTYPE GUIDs, after the format tag */
+static const char SUBTYPE[14] = {
+	0x00, 0x00, 0x00, 0x00, 0x10, 0x00, (char)0x80, 0x00, 0x00, (char)0xaa, 0x00, 0x38, (char)0x9b, 0x71
+};
+
+/*
+ * The fmt chunk, 24 bytes, or 48 for WAVE_FORMAT_EXTENSIBLE, which more
+ * than two channels and float samples need for readers to take them as
+ * meant; returns its length
+ */
+static size_t fmt_chunk(char *p, const pa_sample_spec *spec) {
+	const size_t frame = pa_frame_size(spec);
+	const int tag = (spec->format == PA_SAMPLE_FLOAT32LE) ? 3 : 1;
+	const bool ext = spec->channels > 2 || tag == 3;
+	
+	memcpy(p, "fmt ", 4);
+	put_le(p+4, ext ? 40 : 16, 4);
+	put_le(p+8, ext ? 0xfffe : tag, 2);
+	put_le(p+10, spec->channels, 2);
+	put_le(p+12, spec->rate, 4);
+	put_le(p+16, spec->rate*frame, 4);
+	put_le(p+20, frame, 2);
+	put_le(p+22, 8*pa_sample_size(spec), 2);
+	if (!ext) {
+		return 24;
+	}
+	
+	put_le(p+24, 22, 2);
+	put_le(p+26, 8*pa_sample_size(spec), 2);
+	/* Front centre for mono, front left and right for stereo, no positions past that */
+	put_le(p+28, spec->channels == 1 ? 0x4 : spec->channels == 2 ? 0x3 : 0, 4);
+	put_le(p+32, tag, 2);
+	memcpy(p+34, SUBTYPE, sizeof(SUBTYPE));
+	return 48;
+}
+
+/* Header for nbytes of audio, followed by a pad byte if odd; returns its length */
+size_t wav_header(char *hdr, const pa_sample_spec *spec, size_t nbytes) {
+	size_t len;
+	
+	memcpy(hdr, "RIFF", 4);
+	memcpy(hdr+8, "WAVE", 4);
+	len = 12 + fmt_chunk(hdr+12, spec);
+	memcpy(hdr+len, "data", 4);
+	put_le(hdr+len+4, nbytes, 4);
+	len += 8;
+	put_le(hdr+4, len - 8 + nbytes + (nbytes & 1), 4);
+	return len;
+}
+
+/* The WAV header, or the RF64 one if there is too much audio for it; returns its length */
+size_t wav_header64(char *hdr, const pa_sample_spec *spec, uint64_t nbytes) {
+	size_t len;
+	
+	if (nbytes <= WAV_MAX_DATA) {
+		return wav_header(hdr, spec, nbytes);
+	}
+	
+	memcpy(hdr, "RF64", 4);
+	put_le(hdr+4, 0xffffffffu, 4);
+	memcpy(hdr+8, "WAVE", 4);
+	memcpy(hdr+12, "ds64", 4);
+	put_le(hdr+16, 28, 4);
+	put_le(hdr+28, nbytes, 8);
+	put_le(hdr+36, nbytes/pa_frame_size(spec), 8);
+	put_le(hdr+44, 0, 4);
+	len = 48 + fmt_chunk(hdr+48, spec);
+	memcpy(hdr+len, "data", 4);
+	put_le(hdr+len+4, 0xffffffffu, 4);
+	len += 8;
+	put_le(hdr+20, len - 8 + nbytes + (nbytes & 1), 8);
+	return len;
+}
@@ -0,0 +1,21 @@
+#ifndef _SOUNDREC_WAV_HEADER_
+#define _SOUNDREC_WAV_HEADER_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pulse/sample.h>
+
+/*
+ * Most bytes in a header, the WAVE_FORMAT_EXTENSIBLE one, and the most
+ * audio it can describe. The canonical header is 44 bytes.
+ */
+#define WAV_HEADER 68
+#define WAV_MAX_DATA (0xffffffffu - 60 - 1)
+/* RF64 adds a ds64 chunk with the 64 bit sizes */
+#define RF64_HEADER 104
+
+size_t wav_header(char *hdr, const pa_sample_spec *spec, size_t nbytes);
+size_t wav_header64(char *hdr, const pa_sample_spec *spec, uint64_t nbytes);
+
+#endif
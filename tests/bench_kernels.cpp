@@ -0,0 +1,160 @@
+/*
+ * The per-format kernels from dsp_kernels() against a generic loop that
+ * works out the format on every sample, for peak, to_float and
+ * from_float over common formats and channel counts.
+ */
+
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <glib.h>
+
+#include "soundrec_dsp.hpp"
+
+using namespace std;
+
+#define FRAMES (1 << 20)
+#define ROUNDS 20
+
+/* Read at run time, so the generic loop can't be specialised behind our back */
+static volatile pa_sample_format_t generic_format;
+/* Where results go so the loops aren't optimised away */
+static volatile float sink;
+
+static float load(pa_sample_format_t f, const char *p) {
+	switch (f) {
+		case PA_SAMPLE_U8:
+			return dsp::U8::load(p);
+		case PA_SAMPLE_S16LE:
+			return dsp::S16::load(p);
+		case PA_SAMPLE_S24LE:
+			return dsp::S24::load(p);
+		case PA_SAMPLE_S32LE:
+			return dsp::S32::load(p);
+		default:
+			return dsp::F32::load(p);
+	}
+}
+
+static void store(pa_sample_format_t f, char *p, float v) {
+	switch (f) {
+		case PA_SAMPLE_U8:
+			dsp::U8::store(p, v);
+			break;
+		case PA_SAMPLE_S16LE:
+			dsp::S16::store(p, v);
+			break;
+		case PA_SAMPLE_S24LE:
+			dsp::S24::store(p, v);
+			break;
+		case PA_SAMPLE_S32LE:
+			dsp::S32::store(p, v);
+			break;
+		default:
+			dsp::F32::store(p, v);
+	}
+}
+
+static float generic_peak(const char *src, size_t frames, unsigned nch) {
+	const size_t bytes = pa_sample_size_of_format(generic_format);
+	float pk = 0.0f, v;
+
+	for (size_t i = 0; i < frames*nch; i++) {
+		v = load(generic_format, src + i*bytes);
+		v = v < 0 ? -v : v;
+		pk = v > pk ? v : pk;
+	}
+	return pk;
+}
+
+static void generic_to_float(const char *src, float *dst, size_t frames, unsigned nch) {
+	const size_t bytes = pa_sample_size_of_format(generic_format);
+
+	for (size_t i = 0; i < frames*nch; i++) {
+		dst[i] = load(generic_format, src + i*bytes);
+	}
+}
+
+static void generic_from_float(const float *src, char *dst, size_t frames, unsigned nch) {
+	const size_t bytes = pa_sample_size_of_format(generic_format);
+
+	for (size_t i = 0; i < frames*nch; i++) {
+		store(generic_format, dst + i*bytes, src[i]);
+	}
+}
+
+/* Megasamples a second over ROUNDS passes */
+static double rate(int64_t t, unsigned nch) {
+	return (double)FRAMES*nch*ROUNDS/(t > 0 ? t : 1);
+}
+
+static void bench(const char *name, pa_sample_format_t format, unsigned nch) {
+	const pa_sample_spec ss = { format, 48000, (uint8_t)nch };
+	Kernels k = dsp_kernels(&ss);
+	vector<char> raw(FRAMES*pa_frame_size(&ss));
+	vector<float> buf(FRAMES*nch);
+	int64_t t[7];
+	size_t i;
+	int r;
+
+	generic_format = format;
+	for (i = 0; i < buf.size(); i++) {
+		buf[i] = (float)((i*2654435761u >> 8) % 2001)/1000.0f - 1.0f;
+	}
+	k.from_float(&buf[0], &raw[0], FRAMES, nch);
+
+	t[0] = g_get_monotonic_time();
+	for (r = 0; r < ROUNDS; r++) {
+		sink = k.peak(&raw[0], FRAMES, nch);
+	}
+	t[1] = g_get_monotonic_time();
+	for (r = 0; r < ROUNDS; r++) {
+		sink = generic_peak(&raw[0], FRAMES, nch);
+	}
+	t[2] = g_get_monotonic_time();
+	for (r = 0; r < ROUNDS; r++) {
+		k.to_float(&raw[0], &buf[0], FRAMES, nch);
+	}
+	t[3] = g_get_monotonic_time();
+	for (r = 0; r < ROUNDS; r++) {
+		generic_to_float(&raw[0], &buf[0], FRAMES, nch);
+	}
+	t[4] = g_get_monotonic_time();
+	for (r = 0; r < ROUNDS; r++) {
+		k.from_float(&buf[0], &raw[0], FRAMES, nch);
+	}
+	t[5] = g_get_monotonic_time();
+	for (r = 0; r < ROUNDS; r++) {
+		generic_from_float(&buf[0], &raw[0], FRAMES, nch);
+	}
+	t[6] = g_get_monotonic_time();
+	sink = buf[FRAMES/2] + raw[FRAMES/3];
+
+	printf("%-4s %u ch  peak %6.0f / %5.0f   to_float %6.0f / %5.0f   from_float %6.0f / %5.0f\n",
+			name, nch, rate(t[1] - t[0], nch), rate(t[2] - t[1], nch), rate(t[3] - t[2], nch),
+			rate(t[4] - t[3], nch), rate(t[5] - t[4], nch), rate(t[6] - t[5], nch));
+}
+
+int main() {
+	static const struct {
+		const char *name;
+		pa_sample_format_t format;
+	} formats[] = {
+		{ "u8", PA_SAMPLE_U8 },
+		{ "s16", PA_SAMPLE_S16LE },
+		{ "s24", PA_SAMPLE_S24LE },
+		{ "s32", PA_SAMPLE_S32LE },
+		{ "f32", PA_SAMPLE_FLOAT32LE },
+	};
+	static const unsigned channels[] = { 1, 2, 6 };
+	size_t i, j;
+
+	printf("Msamples/s, specialised / generic\n");
+	for (i = 0; i < sizeof(formats)/sizeof(formats[0]); i++) {
+		for (j = 0; j < sizeof(channels)/sizeof(channels[0]); j++) {
+			bench(formats[i].name, formats[i].format, channels[j]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Mixdown throughput: a mono and a stereo clip of ten minutes each,
+ * offset against each other, mixed in the background the way Mix does
+ * it, in source samples a second over all cores and per core.
+ */
+
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <glib.h>
+
+#include "soundrec_clip.hpp"
+#include "soundrec_mix.hpp"
+#include "soundrec_pool.hpp"
+
+using namespace std;
+
+#define SECONDS 600
+
+static Clip *make_clip(unsigned nch, uint32_t seed) {
+	const pa_sample_spec ss = { PA_SAMPLE_S16LE, 48000, (uint8_t)nch };
+	Clip *clip = new Clip(STORE_MEMORY, ss);
+	vector<int16_t> buf(ss.rate*nch);
+	size_t i;
+	int s;
+
+	for (s = 0; s < SECONDS; s++) {
+		for (i = 0; i < buf.size(); i++) {
+			seed = seed*1103515245 + 12345;
+			buf[i] = (int16_t)(seed >> 16)/4;
+		}
+		clip->append((const char *)&buf[0], buf.size()*sizeof(buf[0]));
+	}
+	clip->finish();
+	clip->sync(true);
+	return clip;
+}
+
+static void done(Clip *clip, void *data) {
+	*(Clip **)data = clip;
+}
+
+int main() {
+	vector<MixSource> src;
+	Clip *out = NULL;
+	uint64_t samples = 0;
+	unsigned cores = g_get_num_processors();
+	int64_t t;
+	size_t i;
+
+	pool_fill();
+	src.push_back(MixSource(make_clip(1, 1), 0, 1.0f));
+	src.push_back(MixSource(make_clip(2, 2), 48000/3, 0.5f));
+	for (i = 0; i < src.size(); i++) {
+		samples += src[i].clip->rec_size/sizeof(int16_t);
+	}
+
+	t = g_get_monotonic_time();
+	mix_clips(src, STORE_MEMORY, done, &out);
+	while (out == NULL) {
+		g_main_context_iteration(NULL, TRUE);
+	}
+	t = g_get_monotonic_time() - t;
+
+	printf("mixed %zu clips, %.0f s of audio, in %.3f s: %.1f Msamples/s, %.1f Msamples/s/core (%u cores)\n",
+			src.size(), (double)out->rec_size/pa_frame_size(&out->spec)/out->spec.rate, t/1e6,
+			(double)samples/t, (double)samples/t/cores, cores);
+
+	delete out;
+	for (i = 0; i < src.size(); i++) {
+		delete src[i].clip;
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Saving a clip as WAV: the native writer behind save_clip() against
+ * the libsndfile path it replaced, sf_write_raw() a block at a time,
+ * in GB/s into the page cache. Files go to the directory given, or the
+ * temporary directory, and are removed after.
+ */
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+#include <glib.h>
+#include <sndfile.h>
+
+#include "soundrec_clip.hpp"
+#include "soundrec_pool.hpp"
+#include "soundrec_save.hpp"
+
+using namespace std;
+
+#define CLIP_BYTES ((size_t)1024*BLOCK_SIZE)
+#define ROUNDS 3
+
+static bool sndfile_save(Clip *clip, const char *path) {
+	SF_INFO info = {};
+	SNDFILE *sf;
+	const char *p;
+	size_t n;
+	bool ok = true;
+	Cursor cr(clip, 0);
+
+	info.samplerate = clip->spec.rate;
+	info.channels = clip->spec.channels;
+	info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+	if ((sf = sf_open(path, SFM_WRITE, &info)) == NULL) {
+		return false;
+	}
+	while (ok && (n = cr.next(&p, BLOCK_SIZE)) > 0) {
+		ok = sf_write_raw(sf, p, n) == (sf_count_t)n;
+	}
+	return sf_close(sf) == 0 && ok;
+}
+
+static double gbps(int64_t t) {
+	return (double)CLIP_BYTES*ROUNDS/1e3/(t > 0 ? t : 1);
+}
+
+int main(int argc, char **argv) {
+	const pa_sample_spec ss = { PA_SAMPLE_S16LE, 48000, 2 };
+	string dir = argc > 1 ? argv[1] : g_get_tmp_dir();
+	string native = dir + "/soundrec-bench-native.wav", sndfile = dir + "/soundrec-bench-sndfile.wav";
+	Clip *clip = new Clip(STORE_MEMORY, ss);
+	char *buf = (char *)malloc(BLOCK_SIZE);
+	int64_t t[3];
+	size_t i;
+	bool ok = true;
+	int r;
+
+	pool_fill();
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		buf[i] = (char)(1 + i*7%251);
+	}
+	for (i = 0; i < CLIP_BYTES/BLOCK_SIZE; i++) {
+		buf[0] = (char)i;
+		clip->append(buf, BLOCK_SIZE);
+	}
+	clip->finish();
+	clip->sync(true);
+	free(buf);
+
+	/* Removing the files is left out of the times */
+	t[0] = t[1] = 0;
+	for (r = 0; r < ROUNDS; r++) {
+		t[2] = g_get_monotonic_time();
+		ok &= save_clip(clip, native.c_str());
+		t[0] += g_get_monotonic_time() - t[2];
+		unlink(native.c_str());
+
+		t[2] = g_get_monotonic_time();
+		ok &= sndfile_save(clip, sndfile.c_str());
+		t[1] += g_get_monotonic_time() - t[2];
+		unlink(sndfile.c_str());
+	}
+
+	printf("%zu MiB WAV: native %.2f GB/s, sf_write_raw %.2f GB/s\n", CLIP_BYTES >> 20,
+			gbps(t[0]), gbps(t[1]));
+
+	delete clip;
+	if (!ok) {
+		printf("FAIL: can't write to %s\n", dir.c_str());
+		return 1;
+	}
+	return 0;
+}
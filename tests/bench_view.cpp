@@ -0,0 +1,144 @@
+/*
+ * PCM queries: the view into the caller's array and the visitor against
+ * the allocating soundrec_get_pcm, in time and in allocations a query.
+ * Fails if the view or the visitor allocates at all.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <glib.h>
+
+#include "soundrec.hpp"
+#include "soundrec_clip.hpp"
+#include "soundrec_pool.hpp"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+/* Only the main thread's allocations count, and only while measuring */
+static __thread bool counting = false;
+static size_t allocs = 0;
+
+extern "C" void *malloc(size_t size) {
+	allocs += counting;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+	allocs += counting;
+	return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+	allocs += counting;
+	return __libc_realloc(ptr, size);
+}
+
+#define CLIP_BYTES (256*BLOCK_SIZE)
+#define QUERIES 1000000
+#define MAX_FRAG 8
+
+static uint32_t next_rand(uint32_t *x) {
+	*x = *x*1103515245 + 12345;
+	return *x >> 8;
+}
+
+/* A range of up to a few blocks, anywhere in the clip */
+static void range(uint32_t *x, size_t *start, size_t *len) {
+	*len = 4 + next_rand(x) % (4*BLOCK_SIZE);
+	*start = ((uint64_t)next_rand(x) << 24 | next_rand(x)) % (CLIP_BYTES - *len);
+	*start -= *start % 4;
+	*len -= *len % 4;
+}
+
+static void sum_cb(const char *data, size_t n, void *sum) {
+	*(size_t *)sum += data[0] + data[n-1];
+}
+
+typedef size_t (*query)(size_t id, size_t start, size_t len, size_t *sum);
+
+static size_t view(size_t id, size_t start, size_t len, size_t *sum) {
+	pcm_frag frags[MAX_FRAG];
+	size_t nfrag, i;
+	size_t n = soundrec_get_pcm_view(id, start, len, frags, MAX_FRAG, &nfrag);
+
+	for (i = 0; i < nfrag; i++) {
+		*sum += frags[i].data[0] + frags[i].data[frags[i].size-1];
+	}
+	return n;
+}
+
+static size_t visit(size_t id, size_t start, size_t len, size_t *sum) {
+	return soundrec_visit_pcm(id, start, len, sum_cb, sum);
+}
+
+static size_t copy(size_t id, size_t start, size_t len, size_t *sum) {
+	char **data;
+	size_t *size;
+	size_t nfrag, i;
+	size_t n = soundrec_get_pcm(id, start, len, &data, &size, &nfrag);
+
+	for (i = 0; i < nfrag; i++) {
+		*sum += data[i][0] + data[i][size[i]-1];
+	}
+	free(data);
+	free(size);
+	return n;
+}
+
+/* Returns allocations a query */
+static double run(const char *name, query q, size_t id) {
+	uint32_t x = 1;
+	size_t start, len, sum = 0, bytes = 0, i;
+	int64_t t;
+	double a;
+
+	allocs = 0;
+	counting = true;
+	t = g_get_monotonic_time();
+	for (i = 0; i < QUERIES; i++) {
+		range(&x, &start, &len);
+		bytes += q(id, start, len, &sum);
+	}
+	t = g_get_monotonic_time() - t;
+	counting = false;
+	a = (double)allocs/QUERIES;
+
+	printf("%-8s %7.1f ns/query  %5.2f allocations/query  (%zu MiB covered, sum %zu)\n", name,
+			1000.0*t/QUERIES, a, bytes >> 20, sum & 0xff);
+	return a;
+}
+
+int main() {
+	const pa_sample_spec ss = { PA_SAMPLE_S16LE, 48000, 2 };
+	Clip *clip = new Clip(STORE_MEMORY, ss);
+	char *buf = (char *)malloc(BLOCK_SIZE);
+	size_t i;
+	bool ok = true;
+
+	pool_fill();
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		buf[i] = (char)(1 + i%127);
+	}
+	for (i = 0; i < CLIP_BYTES/BLOCK_SIZE; i++) {
+		clip->append(buf, BLOCK_SIZE);
+	}
+	clip->finish();
+	clip->sync(true);
+	free(buf);
+
+	ok &= run("view", view, clip->id) == 0;
+	ok &= run("visit", visit, clip->id) == 0;
+	run("get_pcm", copy, clip->id);
+
+	delete clip;
+	if (!ok) {
+		printf("FAIL: a non-allocating query allocated\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,624 @@
+/*
+ * Stress test for the capture path: fragments of irregular and large
+ * sizes, holes and overruns go through the capture ring into clips and
+ * through the rotator into files, and every frame has to come out where
+ * it went in, or as whole frames of silence where it was lost.
+ */
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "soundrec_align.hpp"
+#include "soundrec_clip.hpp"
+#include "soundrec_ring.hpp"
+#include "soundrec_rotate.hpp"
+#include "soundrec_trigger.hpp"
+#include "soundrec_wav.hpp"
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+static const pa_sample_spec specs[] = {
+	{ PA_SAMPLE_S24LE, 48000, 3 },
+	{ PA_SAMPLE_S16LE, 44100, 1 },
+	{ PA_SAMPLE_U8, 8000, 5 },
+	{ PA_SAMPLE_FLOAT32LE, 96000, 2 },
+	{ PA_SAMPLE_S32LE, 48000, 7 },
+};
+
+static int silence_of(const pa_sample_spec &ss) {
+	return ss.format == PA_SAMPLE_U8 ? 0x80 : 0;
+}
+
+/* Never a silence byte, so lost audio can't pass for what was captured */
+static char pattern(uint64_t pos) {
+	return (char)(1 + (pos*2654435761u >> 7) % 120);
+}
+
+static void make_pattern(vector<char> &v, uint64_t pos, size_t n) {
+	v.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		v[i] = pattern(pos + i);
+	}
+}
+
+static uint32_t next_rand(uint32_t *x) {
+	*x = *x*1103515245 + 12345;
+	return *x >> 8;
+}
+
+/* Fragment sizes in whole frames: mostly small, now and then around the ring's or past a block */
+static size_t fragment(uint32_t *x, size_t frame, size_t ring) {
+	switch (next_rand(x) % 256) {
+		case 0:
+			return frame*(3*BLOCK_SIZE/frame + 7);
+		case 1:
+		case 2:
+			return frame*(ring/frame/2 + next_rand(x) % (ring/frame));
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+			return frame;
+		default:
+			return frame*(1 + next_rand(x) % 1024);
+	}
+}
+
+static bool same_clip(Clip *clip, const vector<char> &want) {
+	const char *p;
+	size_t n;
+	Cursor cr(clip, 0);
+
+	if (clip->rec_size != want.size()) {
+		return false;
+	}
+	while ((n = cr.next(&p, (size_t)-1)) > 0) {
+		if (memcmp(p, &want[cr.pos - n], n) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Clip::append with fragments of any size, frames split between calls,
+ * in every store
+ */
+static void clip_fragments(const pa_sample_spec &ss, clip_store store) {
+	Clip *clip = new Clip(store, ss);
+	vector<char> want, frag;
+	uint32_t x = 1;
+	uint64_t pos = 0;
+	size_t n;
+	int i;
+
+	for (i = 0; i < 60; i++) {
+		switch (i % 6) {
+			case 0:
+				n = 1;
+				break;
+			case 1:
+				n = BLOCK_SIZE - pos%BLOCK_SIZE;
+				break;
+			case 2:
+				n = BLOCK_SIZE + 1;
+				break;
+			case 3:
+				n = 3*BLOCK_SIZE + 5;
+				break;
+			default:
+				n = 1 + next_rand(&x) % 100000;
+		}
+		make_pattern(frag, pos, n);
+		clip->append(&frag[0], n);
+		want.insert(want.end(), frag.begin(), frag.end());
+		pos += n;
+	}
+	clip->finish();
+	clip->sync(true);
+
+	CHECK(same_clip(clip, want), "clip in store %d, %u channels: content differs", store, ss.channels);
+	delete clip;
+}
+
+/* What the producer did to the stream, for the reference */
+class Producer {
+	public:
+		pa_sample_spec spec;
+		Ring *ring;
+		uint64_t frags;
+		uint64_t dropped;
+		uint64_t target;
+		vector<char> want;
+		uint64_t lost;
+		uint32_t seed;
+		volatile bool done;
+};
+
+/*
+ * One fragment as read_cb sees it: a hole now and then, otherwise data
+ * that goes in whole or is owed as silence
+ */
+static void produce(Producer *pr, vector<char> &frag) {
+	const size_t frame = pa_frame_size(&pr->spec);
+	size_t n = fragment(&pr->seed, frame, pr->ring->size());
+	bool hole = next_rand(&pr->seed) % 16 == 0;
+
+	make_pattern(frag, pr->want.size(), n);
+	if (!pr->ring->put(hole ? NULL : &frag[0], n) || hole) {
+		pr->want.resize(pr->want.size() + n, (char)silence_of(pr->spec));
+		pr->lost += n;
+		pr->dropped++;
+	} else {
+		pr->want.insert(pr->want.end(), frag.begin(), frag.end());
+	}
+	pr->frags++;
+}
+
+static void *producer_thread(void *data) {
+	Producer *pr = (Producer *)data;
+	vector<char> frag;
+
+	while (pr->want.size() < pr->target) {
+		produce(pr, frag);
+		g_usleep(next_rand(&pr->seed) % 1000);
+	}
+	pr->done = true;
+	return NULL;
+}
+
+/* Trigger level the checks use */
+#define LEVEL 0.1f
+
+/*
+ * Whether frames of the stream are above LEVEL, by a plain sum; -1 when
+ * too close to call against the trigger's float sums
+ */
+static int above(Kernels &k, const char *data, size_t frames) {
+	vector<float> fl(frames*k.channels);
+	double sum = 0.0, rms;
+	size_t i;
+
+	k.to_float(data, &fl[0], frames, k.channels);
+	for (i = 0; i < fl.size(); i++) {
+		sum += (double)fl[i]*fl[i];
+	}
+	rms = sqrt(sum/fl.size());
+	if (fabs(rms - LEVEL) < LEVEL/100) {
+		return -1;
+	}
+	return rms >= LEVEL;
+}
+
+/* Everything drain_ring hands captured audio to, each of its own */
+class Sinks {
+	public:
+		Kernels k;
+		Clip *clip;
+		/* One track, mixed into a clip of its own */
+		Aligner *al;
+		Clip *mixed;
+		History *hist;
+		Trigger *trig;
+		size_t wrong;
+		Sinks(const pa_sample_spec &ss, size_t history) : k(dsp_kernels(&ss)), wrong(0) {
+			vector<pa_sample_spec> in(1, ss);
+
+			clip = new Clip(STORE_MEMORY, ss);
+			al = new Aligner(ss.format, in);
+			al->mark(0, 0, 0);
+			mixed = new Clip(STORE_MEMORY, al->spec);
+			hist = new History(history, k.frame);
+			trig = new Trigger(ss, LEVEL);
+		}
+		void feed(const char *data, size_t n) {
+			int want = above(k, data, n/k.frame);
+
+			clip->append(data, n);
+			al->feed(0, data, n);
+			hist->keep(data, n);
+			wrong += trig->loud(data, n) != want && want >= 0;
+		}
+		~Sinks() {
+			delete clip;
+			delete al;
+			delete mixed;
+			delete hist;
+			delete trig;
+		}
+};
+
+/*
+ * Everything the ring has, then the silence still owed, as drain_last
+ * does; the ring must hand out whole frames, across its end too
+ */
+static void drain(Ring *ring, Sinks *sk, const pa_sample_spec &ss, bool last) {
+	const size_t frame = pa_frame_size(&ss);
+	const char *p;
+	vector<char> buf;
+	size_t n;
+
+	while ((n = ring->peek(&p)) > 0) {
+		CHECK(n % frame == 0, "ring of %zu handed out %zu bytes, not whole %zu-byte frames", ring->size(), n, frame);
+		sk->feed(p, n);
+		ring->consume(n);
+	}
+	if (last && ring->owed > 0) {
+		buf.assign(ring->owed, (char)silence_of(ss));
+		sk->feed(&buf[0], buf.size());
+		ring->owed = 0;
+	}
+	sk->al->mix(sk->mixed);
+}
+
+/*
+ * The capture ring overrun over and over, by a producer thread against a
+ * slow consumer, with rings too small for the fragments now and then.
+ * What comes out goes to every kind of consumer drain_ring has, and the
+ * clip, the aligned mix, the history and the trigger must all see the
+ * stream as it went in.
+ */
+static void ring_overrun(const pa_sample_spec &ss, size_t ring_size) {
+	const size_t frame = pa_frame_size(&ss);
+	Producer pr;
+	Sinks sk(ss, 100000*frame);
+	vector<char> want;
+	vector<float> fl;
+	GThread *th;
+	Clip *replay;
+	uint32_t x = 7;
+	size_t n;
+
+	pr.spec = ss;
+	pr.ring = new Ring(ring_size, frame, silence_of(ss));
+	pr.frags = 0;
+	pr.dropped = 0;
+	pr.target = 16*BLOCK_SIZE;
+	pr.lost = 0;
+	pr.seed = 3;
+	pr.done = false;
+
+	th = g_thread_new("producer", producer_thread, &pr);
+	while (!pr.done) {
+		drain(pr.ring, &sk, ss, false);
+		g_usleep(next_rand(&x) % 2000);
+	}
+	g_thread_join(th);
+	drain(pr.ring, &sk, ss, true);
+	sk.clip->finish();
+	sk.clip->sync(true);
+	sk.mixed->finish();
+	sk.mixed->sync(true);
+
+	CHECK(sk.clip->rec_size % frame == 0, "ring of %zu, frame %zu: partial frame at the end", ring_size, frame);
+	CHECK(same_clip(sk.clip, pr.want), "ring of %zu, frame %zu: %llu fragments, %llu bytes lost, content differs",
+			ring_size, frame, (unsigned long long)pr.frags, (unsigned long long)pr.lost);
+
+	/* The aligner's samples go through float and back; interpolation holds back a frame or two */
+	n = pr.want.size()/frame;
+	fl.resize(n*ss.channels);
+	want.resize(n*frame);
+	sk.k.to_float(&pr.want[0], &fl[0], n, ss.channels);
+	sk.k.from_float(&fl[0], &want[0], n, ss.channels);
+	CHECK(sk.mixed->rec_size/frame + 2 >= n, "ring of %zu, frame %zu: %zu of %zu frames aligned", ring_size, frame,
+			sk.mixed->rec_size/frame, n);
+	want.resize(sk.mixed->rec_size < want.size() ? sk.mixed->rec_size : want.size());
+	CHECK(same_clip(sk.mixed, want), "ring of %zu, frame %zu: aligned track differs", ring_size, frame);
+
+	replay = new Clip(STORE_MEMORY, ss);
+	n = sk.hist->replay(replay);
+	replay->finish();
+	want.assign(pr.want.end() - n, pr.want.end());
+	CHECK(n == 100000*frame && same_clip(replay, want), "ring of %zu, frame %zu: history replays %zu bytes wrong",
+			ring_size, frame, n);
+	delete replay;
+
+	CHECK(sk.wrong == 0, "ring of %zu, frame %zu: trigger wrong on %zu pieces", ring_size, frame, sk.wrong);
+
+	printf("ring %7zu frame %2zu: %4llu of %4llu fragments, %5.1f%% of the bytes, lost as silence\n", ring_size,
+			frame, (unsigned long long)pr.dropped, (unsigned long long)pr.frags, 100.0*pr.lost/pr.want.size());
+
+	delete pr.ring;
+}
+
+/*
+ * Two tracks fed in pieces that split their frames anywhere, the way a
+ * ring hands them out: interleaved, every output frame must hold both
+ * tracks' frames of the same number, with nothing rotated or shifted
+ */
+static void aligner_split(pa_sample_format_t format, unsigned ch0, unsigned ch1) {
+	vector<pa_sample_spec> in(2);
+	vector<char> frag, want;
+	uint64_t pos[2] = { 0, 0 };
+	const uint64_t frames = 300000;
+	size_t frame[2], n, j;
+	uint32_t x = 5;
+	unsigned t;
+	Clip *clip;
+
+	in[0].format = in[1].format = format;
+	in[0].rate = in[1].rate = 48000;
+	in[0].channels = ch0;
+	in[1].channels = ch1;
+	frame[0] = pa_frame_size(&in[0]);
+	frame[1] = pa_frame_size(&in[1]);
+
+	Aligner al(format, in);
+	clip = new Clip(STORE_MEMORY, al.spec);
+	al.mark(0, 0, 0);
+	al.mark(1, 0, 0);
+
+	while (pos[0] < frames*frame[0] || pos[1] < frames*frame[1]) {
+		t = next_rand(&x) % 2;
+		n = next_rand(&x) % 4 == 0 ? 1 + next_rand(&x) % frame[t] : 1 + next_rand(&x) % (frame[t]*700);
+		n = n < frames*frame[t] - pos[t] ? n : frames*frame[t] - pos[t];
+		if (n == 0) {
+			continue;
+		}
+		/* Each track's bytes come from a stream of their own */
+		make_pattern(frag, pos[t] + t*(1ull << 40), n);
+		al.feed(t, &frag[0], n);
+		pos[t] += n;
+		al.mix(clip);
+	}
+	clip->finish();
+	clip->sync(true);
+
+	for (j = 0; j < frames; j++) {
+		make_pattern(frag, j*frame[0], frame[0]);
+		want.insert(want.end(), frag.begin(), frag.end());
+		make_pattern(frag, j*frame[1] + (1ull << 40), frame[1]);
+		want.insert(want.end(), frag.begin(), frag.end());
+	}
+	/* Interpolation holds back the last frame or two */
+	n = clip->rec_size;
+	CHECK(n % al.k.frame == 0 && n/al.k.frame + 2 >= frames,
+			"aligner, %zu and %zu-byte frames: %zu bytes out for %llu frames", frame[0], frame[1], n,
+			(unsigned long long)frames);
+	want.resize(n < want.size() ? n : want.size());
+	CHECK(same_clip(clip, want), "aligner, %zu and %zu-byte frames split between feeds: tracks out of line",
+			frame[0], frame[1]);
+	delete clip;
+}
+
+/*
+ * Loud and quiet stretches of whole frames, about bytes long. Quiet
+ * samples have only their lowest byte set, so read a byte off they are
+ * loud: a stream heard out of step with its frames gives itself away.
+ */
+static void make_stretches(vector<char> &stream, const pa_sample_spec &ss, size_t bytes, uint32_t *x) {
+	const size_t frame = pa_frame_size(&ss), sample = pa_sample_size(&ss);
+	vector<char> frag;
+	size_t n, i;
+
+	stream.clear();
+	while (stream.size() < bytes) {
+		n = frame*(1 + next_rand(x) % 20000);
+		if (next_rand(x) % 2) {
+			make_pattern(frag, stream.size(), n);
+		} else {
+			frag.assign(n, (char)silence_of(ss));
+			for (i = 0; i < n; i += sample) {
+				frag[i] = sample == 1 ? (char)0x81 : 0x7f;
+			}
+		}
+		stream.insert(stream.end(), frag.begin(), frag.end());
+	}
+}
+
+/*
+ * The trigger fed in pieces that split frames anywhere: whenever a piece
+ * completes frames, the answer must be the level of exactly those frames
+ */
+static void trigger_split(const pa_sample_spec &ss) {
+	const size_t frame = pa_frame_size(&ss);
+	Trigger trig(ss, LEVEL);
+	Kernels k = dsp_kernels(&ss);
+	vector<char> stream;
+	uint64_t pos = 0, first, end;
+	size_t n, checked = 0, wrong = 0;
+	uint32_t x = 13;
+	bool loud;
+	int want;
+
+	make_stretches(stream, ss, 8*BLOCK_SIZE, &x);
+	while (pos < stream.size()) {
+		n = next_rand(&x) % 4 == 0 ? 1 + next_rand(&x) % frame : 1 + next_rand(&x) % (frame*3000);
+		n = n < stream.size() - pos ? n : stream.size() - pos;
+		loud = trig.loud(&stream[pos], n);
+		first = (pos + frame - 1)/frame*frame;
+		end = pos + n;
+		pos = end;
+		if (end < first + frame || (want = above(k, &stream[first], (end - first)/frame)) < 0) {
+			continue;
+		}
+		checked++;
+		wrong += loud != (bool)want;
+	}
+	CHECK(wrong == 0, "trigger, %zu-byte frames split between pieces: %zu of %zu answers wrong", frame, wrong,
+			checked);
+}
+
+/*
+ * The history kept, passed over and replayed in pieces that split frames
+ * anywhere: a replay is the end of what was kept since the stream last
+ * went elsewhere, from the first frame boundary in it
+ */
+static void history_split(const pa_sample_spec &ss) {
+	const size_t frame = pa_frame_size(&ss);
+	/* Rounded down to whole frames */
+	const size_t cap = frame*5000;
+	History hist(cap + frame - 1, frame);
+	vector<char> stream, want;
+	uint64_t pos = 0, run = 0;
+	size_t n, got, used, replays = 0, wrong = 0;
+	uint32_t x = 17;
+	Clip *clip;
+
+	make_stretches(stream, ss, 4*BLOCK_SIZE, &x);
+	while (pos < stream.size()) {
+		n = next_rand(&x) % 4 == 0 ? 1 + next_rand(&x) % frame : 1 + next_rand(&x) % (frame*3000);
+		n = n < stream.size() - pos ? n : stream.size() - pos;
+
+		switch (next_rand(&x) % 8) {
+			case 0:
+				/* Into a clip instead */
+				hist.pass(n);
+				run = 0;
+				break;
+			case 1:
+				clip = new Clip(STORE_MEMORY, ss);
+				got = hist.replay(clip);
+				clip->finish();
+				used = run < cap ? run : cap;
+				if (got > used || got + frame <= used || (got > 0 && (pos - got)%frame != 0)) {
+					wrong++;
+				} else {
+					want.assign(stream.begin() + (pos - got), stream.begin() + pos);
+					wrong += !same_clip(clip, want);
+				}
+				replays++;
+				delete clip;
+				run = 0;
+				/* Fall through, the piece is kept after the replay */
+			default:
+				hist.keep(&stream[pos], n);
+				run += n;
+		}
+		pos += n;
+	}
+	CHECK(wrong == 0, "history, %zu-byte frames split between pieces: %zu of %zu replays wrong", frame, wrong,
+			replays);
+}
+
+static bool read_file(const char *path, vector<char> &out) {
+	FILE *f = fopen(path, "rb");
+	char buf[65536];
+	size_t n;
+
+	if (f == NULL) {
+		return false;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		out.insert(out.end(), buf, buf + n);
+	}
+	fclose(f);
+	return true;
+}
+
+/*
+ * Bytes in pieces that split frames into a rotator whose writer can't
+ * keep up: every file but the last holds exactly the limit, and every
+ * frame is the one written there or silence
+ */
+static void rotation(const pa_sample_spec &ss) {
+	const size_t frame = pa_frame_size(&ss);
+	const size_t limit = frame*(BLOCK_SIZE/frame/2 + 1);
+	char dir[] = "/tmp/soundrec-check-XXXXXX", path[256], hdr[WAV_HEADER];
+	vector<char> frag, got, file;
+	uint64_t pos = 0, total = 6*BLOCK_SIZE + 5, lost = 0;
+	Rotator *rot;
+	uint32_t x = 11;
+	size_t n, hlen, i;
+	unsigned k;
+	bool whole = true;
+
+	if (mkdtemp(dir) == NULL) {
+		CHECK(false, "can't make a directory for the rotated files");
+		return;
+	}
+	rot = new Rotator(ss, dir, "seg", limit, 64*1024);
+	while (pos < total) {
+		n = 1 + next_rand(&x) % (frame*5000);
+		n = n < total - pos ? n : total - pos;
+		make_pattern(frag, pos, n);
+		rot->write(&frag[0], n);
+		pos += n;
+	}
+	delete rot;
+
+	hlen = wav_header(hdr, &ss, 0);
+	for (k = 1; ; k++) {
+		snprintf(path, sizeof(path), "%s/seg%u.wav", dir, k);
+		file.clear();
+		if (!read_file(path, file)) {
+			break;
+		}
+		unlink(path);
+		CHECK(file.size() >= hlen, "%s: no header", path);
+		if (file.size() < hlen) {
+			continue;
+		}
+		/* The data size closes the header; the chunk may be padded past it */
+		n = (uint8_t)file[hlen-4] | (uint8_t)file[hlen-3] << 8 | (uint8_t)file[hlen-2] << 16 |
+				(size_t)(uint8_t)file[hlen-1] << 24;
+		CHECK(hlen + n <= file.size() && n%frame == 0, "%s: %zu bytes of data in %zu", path, n, file.size());
+		CHECK(n == limit || total - got.size() - n < limit, "%s: cut at %zu bytes, not %zu", path, n, limit);
+		n = hlen + n <= file.size() ? n : file.size() - hlen;
+		got.insert(got.end(), file.begin() + hlen, file.begin() + hlen + n);
+	}
+	rmdir(dir);
+
+	/* The partial frame at the end never goes out */
+	CHECK(got.size() == total - total%frame, "%u channels: %zu bytes in the files, %llu written",
+			ss.channels, got.size(), (unsigned long long)(total - total%frame));
+
+	for (i = 0; i + frame <= got.size() && i + frame <= total; i += frame) {
+		make_pattern(frag, i, frame);
+		if (memcmp(&got[i], &frag[0], frame) == 0) {
+			continue;
+		}
+		frag.assign(frame, (char)silence_of(ss));
+		if (memcmp(&got[i], &frag[0], frame) == 0) {
+			lost += frame;
+		} else {
+			whole = false;
+		}
+	}
+	CHECK(whole, "%u channels: frames in the rotated files are split or shifted", ss.channels);
+	printf("rotate frame %2zu: %u files, %5.1f%% lost as silence\n", frame, k - 1, 100.0*lost/total);
+}
+
+int main() {
+	size_t i;
+
+	clip_set_spool_dir(g_get_tmp_dir());
+	for (i = 0; i < sizeof(specs)/sizeof(specs[0]); i++) {
+		clip_fragments(specs[i], STORE_MEMORY);
+		clip_fragments(specs[i], STORE_SPOOL);
+		clip_fragments(specs[i], STORE_MAPPED);
+		ring_overrun(specs[i], 1 << 16);
+		ring_overrun(specs[i], 1 << 22);
+		rotation(specs[i]);
+		trigger_split(specs[i]);
+		history_split(specs[i]);
+	}
+	aligner_split(PA_SAMPLE_S24LE, 1, 2);
+	aligner_split(PA_SAMPLE_S16LE, 6, 1);
+	aligner_split(PA_SAMPLE_U8, 3, 5);
+
+	if (failures > 0) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("capture path: all checks passed\n");
+	return 0;
+}